@@ -1,43 +1,350 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define MAX_STATES 100
-#define MAX_ALPHABET 128
+#define NUM_BYTES 256
+#define WORD_BITS 64
+#define NFA_BITSET_STATES 256
 #define MAX_INPUT_LENGTH 1000
+#define STREAM_BUFFER_SIZE 65536
+#define ACCEL_BYTES 3
+
+// Allocates memory or exits; the automata are useless without it
+void *checkedRealloc(void *ptr, size_t size)
+{
+    ptr = realloc(ptr, size);
+    if (ptr == NULL && size > 0)
+    {
+        fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
+        exit(1);
+    }
+    return ptr;
+}
+
+// Allocates zeroed memory or exits, like checkedRealloc
+void *checkedCalloc(size_t count, size_t size)
+{
+    void *ptr = calloc(count, size);
+    if (ptr == NULL && count > 0 && size > 0)
+    {
+        fprintf(stderr, "Out of memory allocating %zu bytes\n", count * size);
+        exit(1);
+    }
+    return ptr;
+}
 
 typedef struct
 {
     int numStates;
+    int stateCapacity; // rows allocated in transitionTable
     int numFinalStates;
-    int finalStates[MAX_STATES];
-    int transitionTable[MAX_STATES][MAX_ALPHABET];
+    int finalCapacity;
+    int *finalStates;
+    int *transitionTable; // stateCapacity rows of NUM_BYTES entries
     int currentState;
+
+    // Scanning form built by finalizeDFA(). Bytes that behave the same in every
+    // state share a class, and scanTable has numStates + 1 rows of numClasses
+    // entries. Row numStates is a dead state that loops on every class, so the
+    // matching loop never has to test for a missing transition. Entries are
+    // stateWidth bytes wide: uint8_t when the state ids fit, else uint16_t or int.
+    int numClasses;
+    unsigned char byteClass[NUM_BYTES];
+    int stateWidth;
+    void *scanTable;
+    bool *accepting;
+
+    // Acceleration, also built by finalizeDFA(). escapeCount[s] is how many
+    // bytes take state s (the dead state included) anywhere but back to s,
+    // capped at ACCEL_BYTES + 1. If it is at most ACCEL_BYTES, those bytes are
+    // listed from escapeBytes[s * ACCEL_BYTES] and the scan jumps straight to
+    // the next of them; a state with none, such as the dead state, is never
+    // left, so the scan stops there.
+    unsigned char *escapeCount;
+    unsigned char *escapeBytes;
+
+    // Every accepted input contains one of requiredBytes, also worked out by
+    // finalizeDFA() so that matching never writes to the DFA. numRequired is 0
+    // if there is no such set of at most ACCEL_BYTES bytes.
+    int numRequired;
+    unsigned char requiredBytes[ACCEL_BYTES];
+
+    // For DFAs that match several patterns at once: the ids of the patterns
+    // accepted in state s are patternIds[patternStart[s]] up to
+    // patternIds[patternStart[s + 1]], in increasing order. Lists rather than
+    // bitsets keep this small for thousands of patterns. patternStart is NULL
+    // for an ordinary DFA.
+    int numPatterns;
+    int *patternStart;
+    int *patternIds;
+
+    // Set for a DFA loaded by loadDFA(): the tables above point into this
+    // read-only mapping of the file and transitionTable is NULL
+    void *mapping;
+    size_t mappingSize;
 } DFA;
 
+// Makes room for at least numStates rows, growing the table geometrically so
+// that adding states one at a time stays cheap
+void reserveDFAStates(DFA *dfa, int numStates)
+{
+    if (numStates <= dfa->stateCapacity)
+        return;
+
+    int capacity = dfa->stateCapacity > 0 ? dfa->stateCapacity : 4;
+    while (capacity < numStates)
+        capacity *= 2;
+
+    dfa->transitionTable = checkedRealloc(dfa->transitionTable, sizeof(int) * capacity * NUM_BYTES);
+    for (int i = dfa->stateCapacity * NUM_BYTES; i < capacity * NUM_BYTES; i++)
+    {
+        dfa->transitionTable[i] = -1; // all transitions are invalid by default until defined
+    }
+    dfa->stateCapacity = capacity;
+}
+
+void addFinalStateDFA(DFA *dfa, int state)
+{
+    if (dfa->numFinalStates == dfa->finalCapacity)
+    {
+        dfa->finalCapacity = dfa->finalCapacity > 0 ? dfa->finalCapacity * 2 : 4;
+        dfa->finalStates = checkedRealloc(dfa->finalStates, sizeof(int) * dfa->finalCapacity);
+    }
+    dfa->finalStates[dfa->numFinalStates++] = state;
+}
+
 DFA *createDFA(int numStates, int numFinalStates, int *finalStates)
 {
-    DFA *dfa = malloc(sizeof(DFA));
+    DFA *dfa = checkedCalloc(1, sizeof(DFA));
     dfa->numStates = numStates;
-    dfa->numFinalStates = numFinalStates;
-    memcpy(dfa->finalStates, finalStates, numFinalStates * sizeof(int));
-
-    for (int s = 0; s < MAX_STATES; s++)
+    reserveDFAStates(dfa, numStates);
+    for (int i = 0; i < numFinalStates; i++)
     {
-        for (int x = 0; x < MAX_ALPHABET; x++)
-        {
-            dfa->transitionTable[s][x] = -1; // all transitions are invalid by default until defined
-        }
+        addFinalStateDFA(dfa, finalStates[i]);
     }
 
     dfa->currentState = 0;
     return dfa;
 }
 
+void freeDFA(DFA *dfa)
+{
+    if (dfa->mapping != NULL)
+    {
+        munmap(dfa->mapping, dfa->mappingSize);
+        free(dfa);
+        return;
+    }
+    free(dfa->finalStates);
+    free(dfa->transitionTable);
+    free(dfa->scanTable);
+    free(dfa->accepting);
+    free(dfa->escapeCount);
+    free(dfa->escapeBytes);
+    free(dfa->patternStart);
+    free(dfa->patternIds);
+    free(dfa);
+}
+
+// Adds a transition, growing the DFA if either state is beyond its current size
 void addTransitionDFA(DFA *dfa, int fromState, char input, int toState)
 {
-    dfa->transitionTable[fromState][(unsigned char)input] = toState;
+    int needed = (fromState > toState ? fromState : toState) + 1;
+    reserveDFAStates(dfa, needed);
+    if (needed > dfa->numStates)
+        dfa->numStates = needed;
+
+    dfa->transitionTable[fromState * NUM_BYTES + (unsigned char)input] = toState;
+
+    // The scanning form is stale now; it is rebuilt on the next match
+    free(dfa->scanTable);
+    dfa->scanTable = NULL;
+}
+
+// Reads entry i of the DFA's scan table, whatever its width
+int scanEntryDFA(DFA *dfa, size_t i)
+{
+    if (dfa->stateWidth == sizeof(uint8_t))
+        return ((uint8_t *)dfa->scanTable)[i];
+    if (dfa->stateWidth == sizeof(uint16_t))
+        return ((uint16_t *)dfa->scanTable)[i];
+    return ((int *)dfa->scanTable)[i];
+}
+
+// Returns the target of state s on byte x, or -1 if there is none. A DFA
+// loaded from a file has only its scan table to look in.
+int transitionDFA(DFA *dfa, int s, int x)
+{
+    if (dfa->transitionTable == NULL)
+    {
+        int t = scanEntryDFA(dfa, (size_t)s * dfa->numClasses + dfa->byteClass[x]);
+        return t == dfa->numStates ? -1 : t;
+    }
+    return dfa->transitionTable[s * NUM_BYTES + x];
+}
+
+// Sets ids to the patterns accepted in state and returns how many there are.
+// The dead state and the states of an ordinary DFA have none.
+int patternsDFA(DFA *dfa, int state, const int **ids)
+{
+    if (dfa->patternStart == NULL || state < 0 || state >= dfa->numStates)
+        return 0;
+    *ids = dfa->patternIds + dfa->patternStart[state];
+    return dfa->patternStart[state + 1] - dfa->patternStart[state];
+}
+
+// Work limit for findRequiredBytesDFA, in state x class visits
+#define REQUIRED_SEARCH_LIMIT (1 << 24)
+
+// Looks for the smallest class of at most ACCEL_BYTES bytes that every
+// accepted input must contain: one whose removal leaves no accepting state
+// reachable from the start. Checking one class is a search over the scan
+// table, so DFAs too large for every class to be checked are left without.
+void findRequiredBytesDFA(DFA *dfa)
+{
+    int n = dfa->numStates + 1, numClasses = dfa->numClasses;
+    dfa->numRequired = 0;
+    if ((long long)n * numClasses * numClasses > REQUIRED_SEARCH_LIMIT)
+        return;
+
+    int classSize[NUM_BYTES] = {0};
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        classSize[dfa->byteClass[x]]++;
+    }
+
+    bool *seen = checkedRealloc(NULL, n);
+    int *queue = checkedRealloc(NULL, sizeof(int) * n);
+    int best = -1;
+    for (int c = 0; c < numClasses; c++)
+    {
+        if (classSize[c] > ACCEL_BYTES || (best != -1 && classSize[c] >= classSize[best]))
+            continue;
+
+        // Breadth-first from the start state without class c
+        bool reachable = false;
+        int queued = 0;
+        memset(seen, 0, n);
+        seen[0] = true;
+        queue[queued++] = 0;
+        for (int i = 0; i < queued && !reachable; i++)
+        {
+            int s = queue[i];
+            reachable = dfa->accepting[s];
+            for (int d = 0; d < numClasses; d++)
+            {
+                int t = scanEntryDFA(dfa, (size_t)s * numClasses + d);
+                if (d != c && !seen[t])
+                {
+                    seen[t] = true;
+                    queue[queued++] = t;
+                }
+            }
+        }
+        if (!reachable)
+            best = c;
+    }
+
+    if (best != -1)
+    {
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            if (dfa->byteClass[x] == best)
+                dfa->requiredBytes[dfa->numRequired++] = x;
+        }
+    }
+    free(seen);
+    free(queue);
+}
+
+// Builds the scanning form of the DFA: the byte classes, the accept bitmap and
+// a state x class table where every missing transition leads to the dead state.
+void finalizeDFA(DFA *dfa)
+{
+    int dead = dfa->numStates;
+
+    // Two bytes are in the same class if their columns are equal in every state
+    int representative[NUM_BYTES];
+    dfa->numClasses = 0;
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        int c = 0;
+        while (c < dfa->numClasses)
+        {
+            int s = 0;
+            while (s < dead && transitionDFA(dfa, s, x) == transitionDFA(dfa, s, representative[c]))
+                s++;
+            if (s == dead)
+                break;
+            c++;
+        }
+        if (c == dfa->numClasses)
+            representative[dfa->numClasses++] = x;
+        dfa->byteClass[x] = c;
+    }
+
+    // Use the narrowest entry type that can hold every state id, dead included
+    if (dead <= UINT8_MAX)
+        dfa->stateWidth = sizeof(uint8_t);
+    else if (dead <= UINT16_MAX)
+        dfa->stateWidth = sizeof(uint16_t);
+    else
+        dfa->stateWidth = sizeof(int);
+
+    free(dfa->scanTable);
+    dfa->scanTable = checkedRealloc(NULL, (size_t)dfa->stateWidth * (dead + 1) * dfa->numClasses);
+    dfa->accepting = checkedRealloc(dfa->accepting, sizeof(bool) * (dead + 1));
+    for (int s = 0; s <= dead; s++)
+    {
+        for (int c = 0; c < dfa->numClasses; c++)
+        {
+            int next = s < dead ? transitionDFA(dfa, s, representative[c]) : -1;
+            int i = s * dfa->numClasses + c;
+            if (next == -1)
+                next = dead;
+
+            if (dfa->stateWidth == sizeof(uint8_t))
+                ((uint8_t *)dfa->scanTable)[i] = next;
+            else if (dfa->stateWidth == sizeof(uint16_t))
+                ((uint16_t *)dfa->scanTable)[i] = next;
+            else
+                ((int *)dfa->scanTable)[i] = next;
+        }
+        dfa->accepting[s] = false;
+    }
+    for (int i = 0; i < dfa->numFinalStates; i++)
+    {
+        dfa->accepting[dfa->finalStates[i]] = true;
+    }
+
+    dfa->escapeCount = checkedRealloc(dfa->escapeCount, dead + 1);
+    dfa->escapeBytes = checkedRealloc(dfa->escapeBytes, (size_t)ACCEL_BYTES * (dead + 1));
+    for (int s = 0; s <= dead; s++)
+    {
+        int escapes = 0;
+        for (int x = 0; x < NUM_BYTES && escapes <= ACCEL_BYTES; x++)
+        {
+            int next = s < dead ? transitionDFA(dfa, s, x) : -1;
+            if ((next == -1 ? dead : next) != s)
+            {
+                if (escapes < ACCEL_BYTES)
+                    dfa->escapeBytes[s * ACCEL_BYTES + escapes] = x;
+                escapes++;
+            }
+        }
+        dfa->escapeCount[s] = escapes;
+    }
+    findRequiredBytesDFA(dfa);
 }
 
 bool runDFA(DFA *dfa, const char *input)
@@ -46,7 +353,7 @@ bool runDFA(DFA *dfa, const char *input)
     printf("Starting state: %d\n", dfa->currentState);
     while (*input)
     {
-        int nextState = dfa->transitionTable[dfa->currentState][(unsigned char)*input];
+        int nextState = transitionDFA(dfa, dfa->currentState, (unsigned char)*input);
         // printf("Input: %c, Current state: %d, Next state: %d\n", *input, dfa->currentState, nextState);
         if (nextState == -1)
         {
@@ -70,228 +377,726 @@ bool runDFA(DFA *dfa, const char *input)
     return false;
 }
 
-void dfaREPL(DFA *dfa)
+bool isDFAFinalState(DFA *dfa, int state)
 {
-    char input[MAX_INPUT_LENGTH];
-    printf("Enter strings to test (or 'quit' to exit):\n");
-    while (1)
+    for (int s = 0; s < dfa->numFinalStates; s++)
     {
-        printf("Enter a string: ");
-        if (fgets(input, sizeof(input), stdin) == NULL)
-        {
-            break;
-        }
-
-        // Remove newline character if present
-        size_t len = strlen(input);
-        if (len > 0 && input[len - 1] == '\n')
-        {
-            input[len - 1] = '\0';
-            len--;
-        }
-
-        // Echo back the user's input
-        printf("You entered: %s\n", input);
-
-        if (strcmp(input, "quit") == 0)
-            break;
-
-        bool result = runDFA(dfa, input);
-        printf("Input '%s' is %s\n", input, result ? "accepted" : "rejected");
-        printf("\n"); // Add a blank line for better readability
+        if (dfa->finalStates[s] == state)
+            return true;
     }
-    printf("\n");
+    return false;
 }
 
-DFA *DFAForContainsXYZZY()
+// Returns the first position in [p, end) holding one of count bytes, or end.
+// One byte is left to memchr. Two or three are tested eight bytes at a time:
+// a byte of word ^ pattern is zero where the byte matches, and
+// (x - 0x01..01) & ~x & 0x80..80 is nonzero exactly when x has a zero byte.
+const unsigned char *findAnyByte(const unsigned char *p, const unsigned char *end,
+                                 const unsigned char *bytes, int count)
 {
-    int finalStates[] = {5};
-    DFA *dfa = createDFA(6, 1, finalStates);
-    addTransitionDFA(dfa, 0, 'x', 1);
-    addTransitionDFA(dfa, 1, 'y', 2);
-    addTransitionDFA(dfa, 2, 'z', 3);
-    addTransitionDFA(dfa, 3, 'z', 4);
-    addTransitionDFA(dfa, 4, 'y', 5);
-    for (int s = 0; s < 6; s++)
+    if (count == 1)
     {
-        for (int x = 0; x < 128; x++)
-        {
-            if (s == 0 && x != 'x')
-                addTransitionDFA(dfa, s, x, 0);
-            else if (s == 1 && x != 'y')
-                addTransitionDFA(dfa, s, x, (x == 'x' ? 1 : 0));
-            else if (s == 2 && x != 'z')
-                addTransitionDFA(dfa, s, x, (x == 'x' ? 1 : 0));
-            else if (s == 3 && x != 'z')
-                addTransitionDFA(dfa, s, x, (x == 'x' ? 1 : 0));
-            else if (s == 4 && x != 'y')
-                addTransitionDFA(dfa, s, x, (x == 'x' ? 1 : 0));
-            else if (s == 5)
-                addTransitionDFA(dfa, s, x, s);
-        }
+        const unsigned char *found = memchr(p, bytes[0], end - p);
+        return found != NULL ? found : end;
     }
-    return dfa;
-}
 
-DFA *DFASubsequence987()
-{
-    int finalStates[] = {3};
-    DFA *dfa = createDFA(4, 1, finalStates);
-    addTransitionDFA(dfa, 0, '9', 1);
-    addTransitionDFA(dfa, 1, '8', 2);
-    addTransitionDFA(dfa, 2, '7', 3);
-    for (int s = 0; s < 4; s++)
+    const uint64_t ones = 0x0101010101010101ULL, highs = ones << 7;
+    uint64_t patterns[ACCEL_BYTES];
+    for (int i = 0; i < count; i++)
     {
-        for (int x = 0; x < 128; x++)
+        patterns[i] = ones * bytes[i];
+    }
+    while (end - p >= 8)
+    {
+        uint64_t word, found = 0;
+        memcpy(&word, p, sizeof(word));
+        for (int i = 0; i < count; i++)
         {
-            if (s == 0 && x != '9')
-                addTransitionDFA(dfa, s, x, 0);
-            else if (s == 1 && x != '8')
-                addTransitionDFA(dfa, s, x, s);
-            else if (s == 2 && x != '7')
-                addTransitionDFA(dfa, s, x, s);
-            else if (s == 3)
-                addTransitionDFA(dfa, s, x, s);
+            uint64_t x = word ^ patterns[i];
+            found |= (x - ones) & ~x & highs;
         }
+        if (found)
+            break;
+        p += 8;
     }
-    return dfa;
-}
-
-DFA *DFA4s()
-{
-    int finalStates[] = {2, 3};
-    DFA *dfa = createDFA(5, 2, finalStates); // continue working from here 22:38 sept 14// either 4/5
-    addTransitionDFA(dfa, 0, '4', 1);
-    addTransitionDFA(dfa, 1, '4', 2);
-    addTransitionDFA(dfa, 2, '4', 3);
-    addTransitionDFA(dfa, 3, '4', 4);
-    for (int s = 0; s < 5; s++)
+    for (; p < end; p++)
     {
-        for (int x = 0; x < 128; x++)
+        for (int i = 0; i < count; i++)
         {
-            if (s == 0 && x != '4')
-                addTransitionDFA(dfa, s, x, 0);
-            else if (s == 1 && x != '4')
-                addTransitionDFA(dfa, s, x, s);
-            else if (s == 2 && x != '4')
-                addTransitionDFA(dfa, s, x, s);
-            else if (s == 3 && x != '4')
-                addTransitionDFA(dfa, s, x, s);
-            else if (s == 4)
-                addTransitionDFA(dfa, s, x, s);
+            if (*p == bytes[i])
+                return p;
         }
     }
-    return dfa;
+    return end;
 }
 
-DFA *DFAForBinaryParity()
-{
-    int finalStates[] = {3};
-    DFA *dfa = createDFA(4, 1, finalStates);
-
-    // State 0: Even 0s, Even 1s
-    // State 1: Odd 0s, Even 1s
-    // State 2: Even 0s, Odd 1s
-    // State 3: Odd 0s, Odd 1s
+// The scanning loop, once per entry width so the compiler sees the real type.
+// It skips to the next escape byte in a state with few of them, stops in a
+// state with none, and otherwise steps byte by byte until it enters such a state.
+#define SCAN_DFA_LOOP(type)                                                         \
+    {                                                                               \
+        const type *table = dfa->scanTable;                                         \
+        while (p < end)                                                             \
+        {                                                                           \
+            int escapes = escapeCount[state];                                       \
+            if (escapes == 0)                                                       \
+                break;                                                              \
+            if (escapes <= ACCEL_BYTES)                                             \
+            {                                                                       \
+                p = findAnyByte(p, end, escapeBytes + state * ACCEL_BYTES, escapes); \
+                if (p == end)                                                       \
+                    break;                                                          \
+            }                                                                       \
+            do                                                                      \
+            {                                                                       \
+                state = table[state * numClasses + byteClass[*p++]];                \
+            } while (p < end && escapeCount[state] > ACCEL_BYTES);                  \
+        }                                                                           \
+    }
 
-    // Transitions for '0'
-    addTransitionDFA(dfa, 0, '0', 1);
-    addTransitionDFA(dfa, 1, '0', 0);
-    addTransitionDFA(dfa, 2, '0', 3);
-    addTransitionDFA(dfa, 3, '0', 2);
+// Runs the scanning form from state over [p, end) and returns the state
+// reached, which is dfa->numStates if the DFA died on the way
+int scanDFA(DFA *dfa, int state, const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char *byteClass = dfa->byteClass;
+    int numClasses = dfa->numClasses;
+    const unsigned char *escapeCount = dfa->escapeCount;
+    const unsigned char *escapeBytes = dfa->escapeBytes;
 
-    // Transitions for '1'
-    addTransitionDFA(dfa, 0, '1', 2);
-    addTransitionDFA(dfa, 1, '1', 3);
-    addTransitionDFA(dfa, 2, '1', 0);
-    addTransitionDFA(dfa, 3, '1', 1);
+    if (dfa->stateWidth == sizeof(uint8_t))
+        SCAN_DFA_LOOP(uint8_t)
+    else if (dfa->stateWidth == sizeof(uint16_t))
+        SCAN_DFA_LOOP(uint16_t)
+    else
+        SCAN_DFA_LOOP(int)
 
-    return dfa;
+    return state;
 }
 
-typedef struct
+// True if [p, end) cannot be accepted because it lacks every required byte.
+// This is a memchr-speed pass, so inputs that are rejected this way never
+// reach the transition table.
+bool lacksRequiredBytesDFA(DFA *dfa, const unsigned char *p, const unsigned char *end)
 {
-    int numStates;
-    int numFinalStates;
-    int finalStates[MAX_STATES];
-    int transitionTable[MAX_STATES][MAX_ALPHABET][MAX_STATES];
-    int numTransitions[MAX_STATES][MAX_ALPHABET];
-    int epsilonTransitions[MAX_STATES][MAX_STATES];
-    int numEpsilonTransitions[MAX_STATES];
-} NFA;
+    return dfa->numRequired > 0 && findAnyByte(p, end, dfa->requiredBytes, dfa->numRequired) == end;
+}
 
-NFA *createNFA(int numStates, int numFinalStates, int *finalStates)
+// Advances the DFA from the given state over len bytes of buf and returns the
+// state reached, or -1 once there is no valid transition. The input does not
+// need to be NUL-terminated, so callers can feed it in chunks and carry the
+// state across buffer boundaries.
+int stepDFA(DFA *dfa, int state, const char *buf, size_t len)
 {
-    NFA *nfa = malloc(sizeof(NFA));
-    nfa->numStates = numStates;
-    nfa->numFinalStates = numFinalStates;
-    memcpy(nfa->finalStates, finalStates, numFinalStates * sizeof(int));
-
-    for (int s = 0; s < MAX_STATES; s++)
-    {
-        for (int x = 0; x < MAX_ALPHABET; x++)
-        {
-            nfa->numTransitions[s][x] = 0;
-        }
-        nfa->numEpsilonTransitions[s] = 0;
-    }
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+    if (state == -1)
+        return -1;
 
-    return nfa;
+    const unsigned char *p = (const unsigned char *)buf;
+    state = scanDFA(dfa, state, p, p + len);
+    return state == dfa->numStates ? -1 : state;
 }
 
-void addTransitionNFA(NFA *nfa, int fromState, char input, int toState)
+// Silent version of runDFA for batch use: no output, and acceptance is a
+// lookup in the accept bitmap, so the loop does one transition table load per
+// byte.
+bool matchDFA(DFA *dfa, const char *input)
 {
-    nfa->transitionTable[fromState][(unsigned char)input][nfa->numTransitions[fromState][(unsigned char)input]++] = toState;
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+
+    const unsigned char *p = (const unsigned char *)input, *end = p + strlen(input);
+    if (lacksRequiredBytesDFA(dfa, p, end))
+        return false;
+    return dfa->accepting[scanDFA(dfa, 0, p, end)];
 }
 
-void addEpsilonTransition(NFA *nfa, int fromState, int toState)
+// Number of strings matchDFABatch advances together. Each step of a DFA run
+// waits on the table load of the step before, so a single run leaves the core
+// mostly idle; independent lanes keep that many loads in flight at once.
+#define BATCH_LANES 16
+
+// Most bytes the lanes take in one run. Lanes that have reached a sink are
+// retired between runs, so one dead string cannot hold its lane for long.
+#define BATCH_BLOCK 64
+
+#define BATCH_LOOP(type)                                                             \
+    {                                                                                \
+        const type *table = dfa->scanTable;                                          \
+        for (size_t i = 0; i < steps; i++)                                           \
+        {                                                                            \
+            for (int l = 0; l < BATCH_LANES; l++)                                    \
+            {                                                                        \
+                state[l] = table[state[l] * numClasses + byteClass[p[l][i]]];        \
+            }                                                                        \
+        }                                                                            \
+    }
+
+// Advances every lane by the same number of bytes
+void advanceBatchDFA(DFA *dfa, int *state, const unsigned char **p, size_t steps)
 {
-    nfa->epsilonTransitions[fromState][nfa->numEpsilonTransitions[fromState]++] = toState;
+    const unsigned char *byteClass = dfa->byteClass;
+    int numClasses = dfa->numClasses;
+
+    if (dfa->stateWidth == sizeof(uint8_t))
+        BATCH_LOOP(uint8_t)
+    else if (dfa->stateWidth == sizeof(uint16_t))
+        BATCH_LOOP(uint16_t)
+    else
+        BATCH_LOOP(int)
+
+    for (int l = 0; l < BATCH_LANES; l++)
+    {
+        p[l] += steps;
+    }
 }
 
-bool runNFA(NFA *nfa, const char *input)
+// Matches count strings against the DFA and sets results[i] to whether
+// inputs[i] is accepted, like calling matchDFA on each. lengths gives the
+// length of each input, or may be NULL for NUL-terminated strings. The strings
+// are run BATCH_LANES at a time, interleaved byte by byte. A lane whose string
+// ends, or whose state can no longer change, takes the next one, so strings of
+// different lengths keep the lanes busy.
+void matchDFABatch(DFA *dfa, const char **inputs, const size_t *lengths, int count, bool *results)
 {
-    bool currentStates[MAX_STATES] = {false};
-    bool nextStates[MAX_STATES] = {false};
-
-    // Initialize with start state
-    currentStates[0] = true;
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
 
-    // Process each input character
-    while (*input)
+    int input[BATCH_LANES];
+    int state[BATCH_LANES];
+    const unsigned char *p[BATCH_LANES];
+    size_t left[BATCH_LANES];
+    int next = 0, live = 0;
+    for (int l = 0; l < BATCH_LANES; l++)
     {
-        memset(nextStates, false, sizeof(nextStates));
+        input[l] = -1;
+    }
 
-        for (int s = 0; s < nfa->numStates; s++)
+    while (true)
+    {
+        // Give idle lanes the next non-empty strings
+        for (int l = 0; l < BATCH_LANES && next < count; l++)
         {
-            if (currentStates[s])
+            while (input[l] == -1 && next < count)
             {
-                // Handle transitions for the current input character
-                for (int i = 0; i < nfa->numTransitions[s][(unsigned char)*input]; i++)
+                size_t length = lengths != NULL ? lengths[next] : strlen(inputs[next]);
+                if (length == 0)
                 {
-                    int nextState = nfa->transitionTable[s][(unsigned char)*input][i];
-                    nextStates[nextState] = true;
+                    results[next++] = dfa->accepting[0];
+                    continue;
                 }
+                input[l] = next++;
+                state[l] = 0;
+                p[l] = (const unsigned char *)inputs[input[l]];
+                left[l] = length;
+                live++;
             }
         }
+        if (live == 0)
+            break;
 
-        memcpy(currentStates, nextStates, sizeof(currentStates));
-        input++;
-    }
-
-    // Check if final state
-    for (int i = 0; i < nfa->numFinalStates; i++)
+        // Run every lane as far as the shortest remaining string, up to a
+        // block. Idle lanes sit in the dead state and read along with a live
+        // lane.
+        size_t steps = BATCH_BLOCK;
+        int shadow = -1;
+        for (int l = 0; l < BATCH_LANES; l++)
+        {
+            if (input[l] != -1 && (shadow == -1 || left[l] < steps))
+            {
+                steps = left[l] < steps ? left[l] : steps;
+                shadow = l;
+            }
+        }
+        for (int l = 0; l < BATCH_LANES; l++)
+        {
+            if (input[l] == -1)
+            {
+                state[l] = dfa->numStates;
+                p[l] = p[shadow];
+                left[l] = steps;
+            }
+        }
+
+        advanceBatchDFA(dfa, state, p, steps);
+
+        for (int l = 0; l < BATCH_LANES; l++)
+        {
+            left[l] -= steps;
+            if (input[l] != -1 && (left[l] == 0 || dfa->escapeCount[state[l]] == 0))
+            {
+                results[input[l]] = dfa->accepting[state[l]];
+                input[l] = -1;
+                live--;
+            }
+        }
+    }
+}
+
+// Runs the DFA over everything readable from fp as one input string. The
+// stream is read in STREAM_BUFFER_SIZE chunks, so there is no limit on the
+// input length, and reading stops early once the DFA has no valid transition.
+bool runDFAStream(DFA *dfa, FILE *fp)
+{
+    // Empty input never reaches stepDFA, which would otherwise finalize
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+
+    char *buffer = checkedRealloc(NULL, STREAM_BUFFER_SIZE);
+    int state = 0;
+    size_t n;
+
+    // A state with no escape bytes is never left, so the rest of the input
+    // cannot change the answer and is not read
+    while (state != -1 && dfa->escapeCount[state] != 0 && (n = fread(buffer, 1, STREAM_BUFFER_SIZE, fp)) > 0)
+    {
+        state = stepDFA(dfa, state, buffer, n);
+    }
+    free(buffer);
+    return state != -1 && dfa->accepting[state];
+}
+
+// Chunks smaller than this are not worth a thread of their own
+#define PARALLEL_MIN_CHUNK (1 << 20)
+// Bytes scanned between checks for start states that have converged
+#define PARALLEL_MERGE_INTERVAL 256
+// Bytes a chunk with a single run left scans between checks of its stop flag
+#define PARALLEL_STOP_INTERVAL (1 << 16)
+
+typedef struct
+{
+    DFA *dfa;
+    const unsigned char *begin;
+    const unsigned char *end;
+    int *map;  // start state -> state reached, for all numStates + 1 states
+    int *stop; // shared; set once the result is known, and map is then unused
+} ChunkScan;
+
+// Computes where every start state ends up after one chunk. Runs from
+// different start states usually fall into the same state within a few bytes,
+// so the runs are advanced a block at a time and merged as soon as two of them
+// agree, and the chunk costs little more than a single run once one is left.
+void *scanChunkDFA(void *arg)
+{
+    ChunkScan *chunk = arg;
+    DFA *dfa = chunk->dfa;
+    int n = dfa->numStates + 1;
+
+    // Run i is in state current[i]; runs merged away point at the run they
+    // joined through merged[i], and active lists the runs still going
+    int *current = checkedRealloc(NULL, sizeof(int) * n);
+    int *merged = checkedRealloc(NULL, sizeof(int) * n);
+    int *active = checkedRealloc(NULL, sizeof(int) * n);
+    int *owner = checkedRealloc(NULL, sizeof(int) * n);
+    int numActive = 0;
+    for (int s = 0; s < n; s++)
+    {
+        current[s] = s;
+        merged[s] = s;
+        active[numActive++] = s;
+        owner[s] = -1;
+    }
+
+    const unsigned char *p = chunk->begin;
+    while (p < chunk->end && !__atomic_load_n(chunk->stop, __ATOMIC_RELAXED))
     {
-        if (currentStates[nfa->finalStates[i]])
+        size_t interval = numActive == 1 ? PARALLEL_STOP_INTERVAL : PARALLEL_MERGE_INTERVAL;
+        const unsigned char *blockEnd = p;
+        if ((size_t)(chunk->end - p) <= interval)
+            blockEnd = chunk->end;
+        else
+            blockEnd = p + interval;
+
+        int kept = 0;
+        for (int i = 0; i < numActive; i++)
         {
-            return true;
+            int run = active[i];
+            int state = scanDFA(dfa, current[run], p, blockEnd);
+            current[run] = state;
+            if (owner[state] == -1)
+            {
+                owner[state] = run;
+                active[kept++] = run;
+            }
+            else
+            {
+                merged[run] = owner[state];
+            }
+        }
+        numActive = kept;
+        for (int i = 0; i < numActive; i++)
+        {
+            owner[current[active[i]]] = -1;
         }
+        p = blockEnd;
     }
 
-    return false;
+    for (int s = 0; s < n; s++)
+    {
+        int run = s;
+        while (merged[run] != run)
+            run = merged[run];
+        merged[s] = run; // shortens the chain for the starts that follow
+        chunk->map[s] = current[run];
+    }
+
+    free(current);
+    free(merged);
+    free(active);
+    free(owner);
+    return NULL;
 }
 
-void nfaREPL(NFA *nfa)
+// Runs the DFA over len bytes of buf on up to numThreads threads. The buffer
+// is split into chunks. The first chunk is run from the start state. Every
+// other chunk is run from all states at once to build a map of where each
+// start state ends up. The maps are then composed in order, and the result is
+// the state the serial run would reach. This helps when runs from different
+// states converge quickly, as they do for most practical DFAs; a DFA that
+// keeps its states apart (such as a counter mod k) makes every chunk cost
+// numStates serial runs.
+bool runDFAParallel(DFA *dfa, const char *buf, size_t len, int numThreads)
+{
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+    if (lacksRequiredBytesDFA(dfa, (const unsigned char *)buf, (const unsigned char *)buf + len))
+        return false;
+
+    size_t maxChunks = len / PARALLEL_MIN_CHUNK;
+    int numChunks = numThreads < 1 ? 1 : numThreads;
+    if ((size_t)numChunks > maxChunks)
+        numChunks = maxChunks > 0 ? (int)maxChunks : 1;
+
+    const unsigned char *p = (const unsigned char *)buf;
+    size_t chunkLength = len / numChunks;
+    int n = dfa->numStates + 1;
+    ChunkScan *chunks = checkedRealloc(NULL, sizeof(ChunkScan) * numChunks);
+    pthread_t *threads = checkedRealloc(NULL, sizeof(pthread_t) * numChunks);
+    bool *started = checkedCalloc(numChunks, sizeof(bool));
+    int stop = 0;
+    for (int i = 1; i < numChunks; i++)
+    {
+        chunks[i].dfa = dfa;
+        chunks[i].stop = &stop;
+        chunks[i].begin = p + i * chunkLength;
+        chunks[i].end = i == numChunks - 1 ? p + len : p + (i + 1) * chunkLength;
+        chunks[i].map = checkedRealloc(NULL, sizeof(int) * n);
+        // Without a thread the chunk is scanned below on this one instead
+        started[i] = pthread_create(&threads[i], NULL, scanChunkDFA, &chunks[i]) == 0;
+    }
+
+    // Once the run reaches a state it can never leave, such as the accepting
+    // state of a DFA for inputs containing some word, the chunks still being
+    // scanned cannot change the result and are told to stop
+    int state = scanDFA(dfa, 0, p, p + (numChunks > 1 ? chunkLength : len));
+    for (int i = 1; i < numChunks; i++)
+    {
+        if (dfa->escapeCount[state] == 0)
+            __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else if (!stop)
+            scanChunkDFA(&chunks[i]);
+        if (!stop)
+            state = chunks[i].map[state];
+        free(chunks[i].map);
+    }
+
+    free(chunks);
+    free(threads);
+    free(started);
+    return dfa->accepting[state];
+}
+
+// Runs the DFA over a whole file. A regular file is mapped into memory and
+// scanned on all online cores; anything else, such as a pipe, is streamed.
+bool runDFAFile(DFA *dfa, FILE *fp)
+{
+    struct stat info;
+    int fd = fileno(fp);
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        size_t len = info.st_size;
+        void *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            bool result = runDFAParallel(dfa, data, len, (int)sysconf(_SC_NPROCESSORS_ONLN));
+            munmap(data, len);
+            return result;
+        }
+    }
+    return runDFAStream(dfa, fp);
+}
+
+// Compiled DFA files, written by saveDFA and mapped back in by loadDFA. The
+// file is the scanning form laid out as it sits in memory, so loading is a
+// header check and an mmap, however long the DFA took to build. Integers are
+// in the byte order of the machine that wrote the file, and every section
+// starts at a multiple of 8 bytes:
+//   header (with the required bytes), byteClass[256], accepting[n + 1], escapeCount[n + 1],
+//   escapeBytes[(n + 1) * ACCEL_BYTES], finalStates[], scanTable,
+//   patternStart[n + 1] and patternIds[] (multi-pattern DFAs only)
+// where n is the number of states. Bump DFA_FILE_VERSION whenever this changes.
+#define DFA_FILE_VERSION 2
+#define DFA_FILE_BYTE_ORDER 0x01020304u
+static const char dfaFileMagic[8] = "DFA-173";
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder; // DFA_FILE_BYTE_ORDER as the writer stored it
+    int32_t numStates;
+    int32_t numClasses;
+    int32_t stateWidth;
+    int32_t numFinalStates;
+    int32_t numPatterns;
+    int32_t numPatternIds;
+    int32_t numRequired;
+    uint8_t requiredBytes[ACCEL_BYTES];
+    uint64_t fileSize;
+} DFAFileHeader;
+
+// Offsets of the sections after the header
+typedef struct
+{
+    size_t byteClass;
+    size_t accepting;
+    size_t escapeCount;
+    size_t escapeBytes;
+    size_t finalStates;
+    size_t scanTable;
+    size_t patternStart;
+    size_t patternIds;
+    size_t end;
+} DFAFileLayout;
+
+size_t alignSection(size_t offset)
+{
+    return (offset + 7) & ~(size_t)7;
+}
+
+DFAFileLayout layoutDFAFile(const DFAFileHeader *header)
+{
+    size_t rows = (size_t)header->numStates + 1;
+    DFAFileLayout layout;
+    layout.byteClass = alignSection(sizeof(DFAFileHeader));
+    layout.accepting = alignSection(layout.byteClass + NUM_BYTES);
+    layout.escapeCount = alignSection(layout.accepting + rows * sizeof(bool));
+    layout.escapeBytes = alignSection(layout.escapeCount + rows);
+    layout.finalStates = alignSection(layout.escapeBytes + rows * ACCEL_BYTES);
+    layout.scanTable = alignSection(layout.finalStates + (size_t)header->numFinalStates * sizeof(int));
+    layout.patternStart = alignSection(layout.scanTable + rows * header->numClasses * header->stateWidth);
+    layout.patternIds = layout.patternStart;
+    if (header->numPatterns > 0)
+        layout.patternIds = alignSection(layout.patternStart + rows * sizeof(int));
+    layout.end = alignSection(layout.patternIds + (size_t)header->numPatternIds * sizeof(int));
+    return layout;
+}
+
+// Pads the file with zeros up to offset and writes size bytes of data there
+bool writeSection(FILE *fp, size_t *written, size_t offset, const void *data, size_t size)
+{
+    static const char zeros[8];
+    if (fwrite(zeros, 1, offset - *written, fp) != offset - *written)
+        return false;
+    *written = offset + size;
+    return size == 0 || fwrite(data, 1, size, fp) == size;
+}
+
+// Writes the scanning form of the DFA to path. Returns false, after
+// reporting why, if the file cannot be written.
+bool saveDFA(DFA *dfa, const char *path)
+{
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+
+    DFAFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, dfaFileMagic, sizeof(header.magic));
+    header.version = DFA_FILE_VERSION;
+    header.byteOrder = DFA_FILE_BYTE_ORDER;
+    header.numStates = dfa->numStates;
+    header.numClasses = dfa->numClasses;
+    header.stateWidth = dfa->stateWidth;
+    header.numFinalStates = dfa->numFinalStates;
+    header.numPatterns = dfa->patternStart != NULL ? dfa->numPatterns : 0;
+    header.numPatternIds = dfa->patternStart != NULL ? dfa->patternStart[dfa->numStates] : 0;
+    header.numRequired = dfa->numRequired;
+    memcpy(header.requiredBytes, dfa->requiredBytes, ACCEL_BYTES);
+    DFAFileLayout layout = layoutDFAFile(&header);
+    header.fileSize = layout.end;
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    size_t rows = (size_t)dfa->numStates + 1, written = 0;
+    bool ok = writeSection(fp, &written, 0, &header, sizeof(header)) &&
+              writeSection(fp, &written, layout.byteClass, dfa->byteClass, NUM_BYTES) &&
+              writeSection(fp, &written, layout.accepting, dfa->accepting, rows * sizeof(bool)) &&
+              writeSection(fp, &written, layout.escapeCount, dfa->escapeCount, rows) &&
+              writeSection(fp, &written, layout.escapeBytes, dfa->escapeBytes, rows * ACCEL_BYTES) &&
+              writeSection(fp, &written, layout.finalStates, dfa->finalStates, (size_t)dfa->numFinalStates * sizeof(int)) &&
+              writeSection(fp, &written, layout.scanTable, dfa->scanTable, rows * dfa->numClasses * dfa->stateWidth);
+    if (ok && header.numPatterns > 0)
+    {
+        ok = writeSection(fp, &written, layout.patternStart, dfa->patternStart, rows * sizeof(int)) &&
+             writeSection(fp, &written, layout.patternIds, dfa->patternIds, (size_t)header.numPatternIds * sizeof(int));
+    }
+    ok = ok && writeSection(fp, &written, layout.end, NULL, 0);
+    if (fclose(fp) != 0)
+        ok = false;
+    if (!ok)
+        perror(path);
+    return ok;
+}
+
+// Checks that every index stored in a mapped DFA file is in range, so that a
+// damaged file cannot make matching read outside its tables. Returns what is
+// wrong, or NULL. This is one pass over the tables; a change that keeps every
+// value in range, such as a transition sent to another valid state, is not
+// detected, since the file carries no checksum.
+const char *checkDFAFile(const DFAFileHeader *header, const char *base)
+{
+    DFAFileLayout layout = layoutDFAFile(header);
+    int n = header->numStates;
+    size_t rows = (size_t)n + 1;
+    int width = n <= UINT8_MAX ? (int)sizeof(uint8_t) : n <= UINT16_MAX ? (int)sizeof(uint16_t) : (int)sizeof(int);
+    if (header->stateWidth != width)
+        return "DFA file has the wrong state width for its size";
+
+    const unsigned char *byteClass = (const unsigned char *)(base + layout.byteClass);
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        if (byteClass[x] >= header->numClasses)
+            return "DFA file has a byte class out of range";
+    }
+    const unsigned char *accepting = (const unsigned char *)(base + layout.accepting);
+    const unsigned char *escapeCount = (const unsigned char *)(base + layout.escapeCount);
+    for (size_t s = 0; s < rows; s++)
+    {
+        if (accepting[s] > 1 || escapeCount[s] > ACCEL_BYTES + 1)
+            return "DFA file has state flags out of range";
+    }
+    const int *finalStates = (const int *)(base + layout.finalStates);
+    for (int i = 0; i < header->numFinalStates; i++)
+    {
+        if (finalStates[i] < 0 || finalStates[i] >= n)
+            return "DFA file has a final state out of range";
+    }
+
+    size_t entries = rows * header->numClasses;
+    const void *table = base + layout.scanTable;
+    for (size_t i = 0; i < entries; i++)
+    {
+        int t = width == sizeof(uint8_t)    ? ((const uint8_t *)table)[i]
+                : width == sizeof(uint16_t) ? ((const uint16_t *)table)[i]
+                                            : ((const int *)table)[i];
+        if (t < 0 || t > n)
+            return "DFA file has a transition out of range";
+    }
+
+    if (header->numPatterns > 0)
+    {
+        const int *patternStart = (const int *)(base + layout.patternStart);
+        const int *patternIds = (const int *)(base + layout.patternIds);
+        if (patternStart[0] != 0 || patternStart[n] != header->numPatternIds)
+            return "DFA file has pattern lists out of range";
+        for (int s = 0; s < n; s++)
+        {
+            if (patternStart[s + 1] < patternStart[s])
+                return "DFA file has pattern lists out of range";
+        }
+        for (int i = 0; i < header->numPatternIds; i++)
+        {
+            if (patternIds[i] < 0 || patternIds[i] >= header->numPatterns)
+                return "DFA file has a pattern id out of range";
+        }
+    }
+    else if (header->numPatternIds != 0)
+    {
+        return "DFA file has pattern lists out of range";
+    }
+    return NULL;
+}
+
+// Maps a file written by saveDFA. The DFA uses the mapped tables in place and
+// has no build table, so it can be run, minimized and combined but not
+// extended with addTransitionDFA. freeDFA unmaps it. Returns NULL, after
+// reporting why, if the file is missing or is not a DFA file this build can use.
+DFA *loadDFA(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        perror(path);
+        return NULL;
+    }
+    struct stat info;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(DFAFileHeader))
+        data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    const char *problem = NULL;
+    const DFAFileHeader *header = data;
+    if (data == MAP_FAILED)
+        problem = "not a compiled DFA";
+    else if (memcmp(header->magic, dfaFileMagic, sizeof(header->magic)) != 0)
+        problem = "not a compiled DFA";
+    else if (header->version != DFA_FILE_VERSION)
+        problem = "unsupported DFA file version";
+    else if (header->byteOrder != DFA_FILE_BYTE_ORDER)
+        problem = "DFA file was written with a different byte order";
+    else if (header->numStates < 0 || header->numClasses < 1 || header->numClasses > NUM_BYTES ||
+             header->numFinalStates < 0 || header->numFinalStates > header->numStates ||
+             header->numPatterns < 0 || header->numPatternIds < 0 ||
+             header->numRequired < 0 || header->numRequired > ACCEL_BYTES ||
+             (header->stateWidth != sizeof(uint8_t) && header->stateWidth != sizeof(uint16_t) &&
+              header->stateWidth != sizeof(int)) ||
+             header->fileSize != (uint64_t)info.st_size ||
+             layoutDFAFile(header).end != header->fileSize)
+        problem = "DFA file is truncated or corrupt";
+    if (problem == NULL)
+        problem = checkDFAFile(header, data);
+    if (problem != NULL)
+    {
+        fprintf(stderr, "%s: %s\n", path, problem);
+        if (data != MAP_FAILED)
+            munmap(data, info.st_size);
+        return NULL;
+    }
+
+    DFAFileLayout layout = layoutDFAFile(header);
+    char *base = data;
+    DFA *dfa = checkedCalloc(1, sizeof(DFA));
+    dfa->mapping = data;
+    dfa->mappingSize = info.st_size;
+    dfa->numStates = header->numStates;
+    dfa->numFinalStates = header->numFinalStates;
+    dfa->finalStates = (int *)(base + layout.finalStates);
+    dfa->numClasses = header->numClasses;
+    memcpy(dfa->byteClass, base + layout.byteClass, NUM_BYTES);
+    dfa->stateWidth = header->stateWidth;
+    dfa->scanTable = base + layout.scanTable;
+    dfa->accepting = (bool *)(base + layout.accepting);
+    dfa->escapeCount = (unsigned char *)(base + layout.escapeCount);
+    dfa->escapeBytes = (unsigned char *)(base + layout.escapeBytes);
+    dfa->numRequired = header->numRequired;
+    memcpy(dfa->requiredBytes, header->requiredBytes, ACCEL_BYTES);
+    if (header->numPatterns > 0)
+    {
+        dfa->numPatterns = header->numPatterns;
+        dfa->patternStart = (int *)(base + layout.patternStart);
+        dfa->patternIds = (int *)(base + layout.patternIds);
+    }
+    return dfa;
+}
+
+void dfaREPL(DFA *dfa)
 {
     char input[MAX_INPUT_LENGTH];
     printf("Enter strings to test (or 'quit' to exit):\n");
@@ -303,6 +1108,7 @@ void nfaREPL(NFA *nfa)
             break;
         }
 
+        // Remove newline character if present
         size_t len = strlen(input);
         if (len > 0 && input[len - 1] == '\n')
         {
@@ -310,363 +1116,3884 @@ void nfaREPL(NFA *nfa)
             len--;
         }
 
-        if (strcmp(input, "quit") == 0)
-            break;
+        // Echo back the user's input
+        printf("You entered: %s\n", input);
+
+        if (strcmp(input, "quit") == 0)
+            break;
+
+        bool result = runDFA(dfa, input);
+        printf("Input '%s' is %s\n", input, result ? "accepted" : "rejected");
+        printf("\n"); // Add a blank line for better readability
+    }
+    printf("\n");
+}
+
+DFA *DFAForContainsXYZZY()
+{
+    int finalStates[] = {5};
+    DFA *dfa = createDFA(6, 1, finalStates);
+    addTransitionDFA(dfa, 0, 'x', 1);
+    addTransitionDFA(dfa, 1, 'y', 2);
+    addTransitionDFA(dfa, 2, 'z', 3);
+    addTransitionDFA(dfa, 3, 'z', 4);
+    addTransitionDFA(dfa, 4, 'y', 5);
+    for (int s = 0; s < 6; s++)
+    {
+        for (int x = 0; x < 128; x++)
+        {
+            if (s == 0 && x != 'x')
+                addTransitionDFA(dfa, s, x, 0);
+            else if (s == 1 && x != 'y')
+                addTransitionDFA(dfa, s, x, (x == 'x' ? 1 : 0));
+            else if (s == 2 && x != 'z')
+                addTransitionDFA(dfa, s, x, (x == 'x' ? 1 : 0));
+            else if (s == 3 && x != 'z')
+                addTransitionDFA(dfa, s, x, (x == 'x' ? 1 : 0));
+            else if (s == 4 && x != 'y')
+                addTransitionDFA(dfa, s, x, (x == 'x' ? 1 : 0));
+            else if (s == 5)
+                addTransitionDFA(dfa, s, x, s);
+        }
+    }
+    return dfa;
+}
+
+DFA *DFASubsequence987()
+{
+    int finalStates[] = {3};
+    DFA *dfa = createDFA(4, 1, finalStates);
+    addTransitionDFA(dfa, 0, '9', 1);
+    addTransitionDFA(dfa, 1, '8', 2);
+    addTransitionDFA(dfa, 2, '7', 3);
+    for (int s = 0; s < 4; s++)
+    {
+        for (int x = 0; x < 128; x++)
+        {
+            if (s == 0 && x != '9')
+                addTransitionDFA(dfa, s, x, 0);
+            else if (s == 1 && x != '8')
+                addTransitionDFA(dfa, s, x, s);
+            else if (s == 2 && x != '7')
+                addTransitionDFA(dfa, s, x, s);
+            else if (s == 3)
+                addTransitionDFA(dfa, s, x, s);
+        }
+    }
+    return dfa;
+}
+
+DFA *DFA4s()
+{
+    int finalStates[] = {2, 3};
+    DFA *dfa = createDFA(5, 2, finalStates); // continue working from here 22:38 sept 14// either 4/5
+    addTransitionDFA(dfa, 0, '4', 1);
+    addTransitionDFA(dfa, 1, '4', 2);
+    addTransitionDFA(dfa, 2, '4', 3);
+    addTransitionDFA(dfa, 3, '4', 4);
+    for (int s = 0; s < 5; s++)
+    {
+        for (int x = 0; x < 128; x++)
+        {
+            if (s == 0 && x != '4')
+                addTransitionDFA(dfa, s, x, 0);
+            else if (s == 1 && x != '4')
+                addTransitionDFA(dfa, s, x, s);
+            else if (s == 2 && x != '4')
+                addTransitionDFA(dfa, s, x, s);
+            else if (s == 3 && x != '4')
+                addTransitionDFA(dfa, s, x, s);
+            else if (s == 4)
+                addTransitionDFA(dfa, s, x, s);
+        }
+    }
+    return dfa;
+}
+
+DFA *DFAForBinaryParity()
+{
+    int finalStates[] = {3};
+    DFA *dfa = createDFA(4, 1, finalStates);
+
+    // State 0: Even 0s, Even 1s
+    // State 1: Odd 0s, Even 1s
+    // State 2: Even 0s, Odd 1s
+    // State 3: Odd 0s, Odd 1s
+
+    // Transitions for '0'
+    addTransitionDFA(dfa, 0, '0', 1);
+    addTransitionDFA(dfa, 1, '0', 0);
+    addTransitionDFA(dfa, 2, '0', 3);
+    addTransitionDFA(dfa, 3, '0', 2);
+
+    // Transitions for '1'
+    addTransitionDFA(dfa, 0, '1', 2);
+    addTransitionDFA(dfa, 1, '1', 3);
+    addTransitionDFA(dfa, 2, '1', 0);
+    addTransitionDFA(dfa, 3, '1', 1);
+
+    return dfa;
+}
+
+typedef struct
+{
+    const char *name;
+    DFA *(*build)(void);
+} NamedDFA;
+
+NamedDFA builtinDFAs[] = {
+    {"xyzzy", DFAForContainsXYZZY},
+    {"987", DFASubsequence987},
+    {"4s", DFA4s},
+    {"parity", DFAForBinaryParity},
+};
+
+DFA *lookupDFA(const char *name)
+{
+    for (size_t i = 0; i < sizeof(builtinDFAs) / sizeof(builtinDFAs[0]); i++)
+    {
+        if (strcmp(builtinDFAs[i].name, name) == 0)
+            return builtinDFAs[i].build();
+    }
+    return NULL;
+}
+
+// Number of 64-bit words in a bitset over n states
+int bitsetWords(int n)
+{
+    return (n + WORD_BITS - 1) / WORD_BITS;
+}
+
+// Numbers distinct keys of keyWords words (sets of states as bitsets) in the
+// order they are first added, with an open-addressing hash table from key to
+// number. Both arrays grow with the number of keys actually added.
+typedef struct
+{
+    int keyWords;
+    int count;
+    int keyCapacity;
+    uint64_t *keys; // key i starts at keys[i * keyWords]
+    int slotMask;   // number of slots minus one, a power of two minus one
+    int *slots;     // key number, or -1 for an empty slot
+} SetTable;
+
+void resizeSlots(SetTable *table, int slots)
+{
+    free(table->slots);
+    table->slotMask = slots - 1;
+    table->slots = checkedRealloc(NULL, sizeof(int) * slots);
+    memset(table->slots, -1, sizeof(int) * slots);
+}
+
+SetTable *createSetTable(int keyWords)
+{
+    SetTable *table = checkedCalloc(1, sizeof(SetTable));
+    table->keyWords = keyWords;
+    table->keyCapacity = 16;
+    table->keys = checkedRealloc(NULL, sizeof(uint64_t) * keyWords * table->keyCapacity);
+    resizeSlots(table, 32);
+    return table;
+}
+
+void freeSetTable(SetTable *table)
+{
+    free(table->keys);
+    free(table->slots);
+    free(table);
+}
+
+uint64_t hashKey(const uint64_t *key, int words)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < words; i++)
+    {
+        h = (h ^ key[i]) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+const uint64_t *setTableKey(SetTable *table, int id)
+{
+    return table->keys + (size_t)id * table->keyWords;
+}
+
+// Returns the slot that holds key, or the empty slot where it would go
+int probeSet(SetTable *table, const uint64_t *key)
+{
+    size_t bytes = sizeof(uint64_t) * table->keyWords;
+    int slot = hashKey(key, table->keyWords) & table->slotMask;
+    while (table->slots[slot] != -1 && memcmp(setTableKey(table, table->slots[slot]), key, bytes) != 0)
+    {
+        slot = (slot + 1) & table->slotMask;
+    }
+    return slot;
+}
+
+// Returns the number of key, or -1 if it has not been added
+int findSet(SetTable *table, const uint64_t *key)
+{
+    return table->slots[probeSet(table, key)];
+}
+
+// Forgets every key but keeps the memory for reuse
+void clearSetTable(SetTable *table)
+{
+    table->count = 0;
+    memset(table->slots, -1, sizeof(int) * (table->slotMask + 1));
+}
+
+// Returns the number of key, adding it if it is new. Adding a key can move the
+// keys, so pointers from setTableKey() are only valid until the next add.
+int findOrAddSet(SetTable *table, const uint64_t *key)
+{
+    size_t bytes = sizeof(uint64_t) * table->keyWords;
+    int slot = probeSet(table, key);
+    if (table->slots[slot] != -1)
+        return table->slots[slot];
+
+    int id = table->count++;
+    if (id == table->keyCapacity)
+    {
+        table->keyCapacity *= 2;
+        table->keys = checkedRealloc(table->keys, bytes * table->keyCapacity);
+    }
+    memcpy(table->keys + (size_t)id * table->keyWords, key, bytes);
+    table->slots[slot] = id;
+
+    // At least twice as many slots as keys keeps the probe sequences short
+    if (2 * table->count > table->slotMask)
+    {
+        resizeSlots(table, 2 * (table->slotMask + 1));
+        for (int i = 0; i < table->count; i++)
+        {
+            slot = hashKey(setTableKey(table, i), table->keyWords) & table->slotMask;
+            while (table->slots[slot] != -1)
+                slot = (slot + 1) & table->slotMask;
+            table->slots[slot] = i;
+        }
+    }
+    return id;
+}
+
+typedef struct
+{
+    int from;
+    int to;
+    int input; // unused for epsilon transitions
+} NFAEdge;
+
+typedef struct
+{
+    int numStates;
+    int numFinalStates;
+    int *finalStates;
+
+    // Transitions in the order addTransitionNFA and addEpsilonTransition
+    // appended them
+    int numEdges;
+    int edgeCapacity;
+    NFAEdge *edges;
+    int numEpsilonEdges;
+    int epsilonCapacity;
+    NFAEdge *epsilonEdges;
+
+    // Compressed sparse rows built by finalizeNFA(). Bytes with the same
+    // transitions in every state share a class. The targets of state s on
+    // class c are targets[offsets[s * numClasses + c]] up to
+    // targets[offsets[s * numClasses + c + 1]], and likewise for the epsilon
+    // targets of s with epsilonOffsets[s].
+    bool finalized;
+    int numClasses;
+    unsigned char byteClass[NUM_BYTES];
+    int *offsets;
+    int *targets;
+    int *epsilonOffsets;
+    int *epsilonTargets;
+
+    // Bitsets, also built by finalizeNFA(). Each set takes numWords words. The
+    // epsilon closure of state s starts at epsilonClosures[s * numWords]. When
+    // there are at most NFA_BITSET_STATES states, the closed successors of
+    // state s on class c start at successorMasks[(s * numClasses + c) * numWords].
+    int numWords;
+    uint64_t *epsilonClosures;
+    uint64_t *successorMasks;
+    uint64_t *finalMask;
+} NFA;
+
+void addFinalStateNFA(NFA *nfa, int state)
+{
+    nfa->finalStates = checkedRealloc(nfa->finalStates, sizeof(int) * (nfa->numFinalStates + 1));
+    nfa->finalStates[nfa->numFinalStates++] = state;
+    if (state >= nfa->numStates)
+        nfa->numStates = state + 1;
+    nfa->finalized = false;
+}
+
+NFA *createNFA(int numStates, int numFinalStates, int *finalStates)
+{
+    NFA *nfa = checkedCalloc(1, sizeof(NFA));
+    nfa->numStates = numStates;
+    for (int i = 0; i < numFinalStates; i++)
+    {
+        addFinalStateNFA(nfa, finalStates[i]);
+    }
+
+    return nfa;
+}
+
+void freeNFA(NFA *nfa)
+{
+    free(nfa->finalStates);
+    free(nfa->edges);
+    free(nfa->epsilonEdges);
+    free(nfa->offsets);
+    free(nfa->targets);
+    free(nfa->epsilonOffsets);
+    free(nfa->epsilonTargets);
+    free(nfa->epsilonClosures);
+    free(nfa->successorMasks);
+    free(nfa->finalMask);
+    free(nfa);
+}
+
+// Appends an edge and grows the NFA if either state is beyond its current size
+void appendEdgeNFA(NFA *nfa, NFAEdge **edges, int *count, int *capacity, NFAEdge edge)
+{
+    if (*count == *capacity)
+    {
+        *capacity = *capacity > 0 ? *capacity * 2 : 64;
+        *edges = checkedRealloc(*edges, sizeof(NFAEdge) * *capacity);
+    }
+    (*edges)[(*count)++] = edge;
+
+    int needed = (edge.from > edge.to ? edge.from : edge.to) + 1;
+    if (needed > nfa->numStates)
+        nfa->numStates = needed;
+    nfa->finalized = false;
+}
+
+void addTransitionNFA(NFA *nfa, int fromState, char input, int toState)
+{
+    NFAEdge edge = {fromState, toState, (unsigned char)input};
+    appendEdgeNFA(nfa, &nfa->edges, &nfa->numEdges, &nfa->edgeCapacity, edge);
+}
+
+void addEpsilonTransition(NFA *nfa, int fromState, int toState)
+{
+    NFAEdge edge = {fromState, toState, 0};
+    appendEdgeNFA(nfa, &nfa->epsilonEdges, &nfa->numEpsilonEdges, &nfa->epsilonCapacity, edge);
+}
+
+int compareEdges(const void *a, const void *b)
+{
+    const NFAEdge *x = a, *y = b;
+    if (x->input != y->input)
+        return x->input - y->input;
+    if (x->from != y->from)
+        return x->from - y->from;
+    return x->to - y->to;
+}
+
+// Sorts the edges by (input, from, to) and drops duplicates
+int sortEdges(NFAEdge *edges, int count)
+{
+    if (count == 0)
+        return 0;
+    qsort(edges, count, sizeof(NFAEdge), compareEdges);
+    int unique = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (unique == 0 || compareEdges(&edges[unique - 1], &edges[i]) != 0)
+            edges[unique++] = edges[i];
+    }
+    return unique;
+}
+
+// Adds the epsilon closure of state to the bitset set
+void orClosureNFA(NFA *nfa, uint64_t *set, int state)
+{
+    const uint64_t *closure = nfa->epsilonClosures + (size_t)state * nfa->numWords;
+    for (int k = 0; k < nfa->numWords; k++)
+    {
+        set[k] |= closure[k];
+    }
+}
+
+// Builds the byte classes, the compressed rows and the bitsets from the edge
+// lists
+void finalizeNFA(NFA *nfa)
+{
+    nfa->numEdges = sortEdges(nfa->edges, nfa->numEdges);
+    nfa->numEpsilonEdges = sortEdges(nfa->epsilonEdges, nfa->numEpsilonEdges);
+
+    // The edges of byte x are edges[first[x]] up to edges[first[x + 1]]
+    int first[NUM_BYTES + 1] = {0};
+    for (int i = 0; i < nfa->numEdges; i++)
+    {
+        first[nfa->edges[i].input + 1]++;
+    }
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        first[x + 1] += first[x];
+    }
+
+    // Two bytes are in the same class if they have the same (from, to) edges
+    int representative[NUM_BYTES];
+    nfa->numClasses = 0;
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        int length = first[x + 1] - first[x];
+        int c = 0;
+        while (c < nfa->numClasses)
+        {
+            int r = representative[c];
+            if (first[r + 1] - first[r] == length)
+            {
+                int i = 0;
+                while (i < length && nfa->edges[first[x] + i].from == nfa->edges[first[r] + i].from &&
+                       nfa->edges[first[x] + i].to == nfa->edges[first[r] + i].to)
+                    i++;
+                if (i == length)
+                    break;
+            }
+            c++;
+        }
+        if (c == nfa->numClasses)
+            representative[nfa->numClasses++] = x;
+        nfa->byteClass[x] = c;
+    }
+
+    // Count the targets of every (state, class) row, then fill the rows
+    int rows = nfa->numStates * nfa->numClasses;
+    free(nfa->offsets);
+    free(nfa->targets);
+    nfa->offsets = checkedCalloc(rows + 1, sizeof(int));
+    for (int c = 0; c < nfa->numClasses; c++)
+    {
+        int r = representative[c];
+        for (int i = first[r]; i < first[r + 1]; i++)
+        {
+            nfa->offsets[nfa->edges[i].from * nfa->numClasses + c + 1]++;
+        }
+    }
+    for (int i = 0; i < rows; i++)
+    {
+        nfa->offsets[i + 1] += nfa->offsets[i];
+    }
+    nfa->targets = checkedRealloc(NULL, sizeof(int) * nfa->offsets[rows]);
+    int *fill = checkedRealloc(NULL, sizeof(int) * (rows + 1));
+    memcpy(fill, nfa->offsets, sizeof(int) * (rows + 1));
+    for (int c = 0; c < nfa->numClasses; c++)
+    {
+        int r = representative[c];
+        for (int i = first[r]; i < first[r + 1]; i++)
+        {
+            nfa->targets[fill[nfa->edges[i].from * nfa->numClasses + c]++] = nfa->edges[i].to;
+        }
+    }
+    free(fill);
+
+    // Epsilon edges are already sorted by from state
+    free(nfa->epsilonOffsets);
+    free(nfa->epsilonTargets);
+    nfa->epsilonOffsets = checkedCalloc(nfa->numStates + 1, sizeof(int));
+    nfa->epsilonTargets = checkedRealloc(NULL, sizeof(int) * nfa->numEpsilonEdges);
+    for (int i = 0; i < nfa->numEpsilonEdges; i++)
+    {
+        nfa->epsilonOffsets[nfa->epsilonEdges[i].from + 1]++;
+        nfa->epsilonTargets[i] = nfa->epsilonEdges[i].to;
+    }
+    for (int s = 0; s < nfa->numStates; s++)
+    {
+        nfa->epsilonOffsets[s + 1] += nfa->epsilonOffsets[s];
+    }
+
+    int words = nfa->numWords = bitsetWords(nfa->numStates);
+    free(nfa->finalMask);
+    nfa->finalMask = checkedCalloc(words, sizeof(uint64_t));
+    for (int i = 0; i < nfa->numFinalStates; i++)
+    {
+        int f = nfa->finalStates[i];
+        nfa->finalMask[f / WORD_BITS] |= 1ULL << (f % WORD_BITS);
+    }
+
+    // Epsilon closure of every state by a depth-first search from it
+    free(nfa->epsilonClosures);
+    nfa->epsilonClosures = checkedCalloc((size_t)nfa->numStates * words, sizeof(uint64_t));
+    int *stack = checkedRealloc(NULL, sizeof(int) * (nfa->numStates + 1));
+    for (int s = 0; s < nfa->numStates; s++)
+    {
+        uint64_t *closure = nfa->epsilonClosures + (size_t)s * words;
+        int top = 0;
+        closure[s / WORD_BITS] |= 1ULL << (s % WORD_BITS);
+        stack[top++] = s;
+        while (top > 0)
+        {
+            int state = stack[--top];
+            for (int i = nfa->epsilonOffsets[state]; i < nfa->epsilonOffsets[state + 1]; i++)
+            {
+                int t = nfa->epsilonTargets[i];
+                if (!(closure[t / WORD_BITS] & (1ULL << (t % WORD_BITS))))
+                {
+                    closure[t / WORD_BITS] |= 1ULL << (t % WORD_BITS);
+                    stack[top++] = t;
+                }
+            }
+        }
+    }
+    free(stack);
+
+    // The successor masks already include the closure of every target, so the
+    // bitset simulation never has to follow epsilon transitions
+    free(nfa->successorMasks);
+    nfa->successorMasks = NULL;
+    if (nfa->numStates <= NFA_BITSET_STATES)
+    {
+        nfa->successorMasks = checkedCalloc((size_t)rows * words, sizeof(uint64_t));
+        for (int row = 0; row < rows; row++)
+        {
+            for (int i = nfa->offsets[row]; i < nfa->offsets[row + 1]; i++)
+            {
+                orClosureNFA(nfa, nfa->successorMasks + (size_t)row * words, nfa->targets[i]);
+            }
+        }
+    }
+
+    nfa->finalized = true;
+}
+
+// Sets next to the states reachable from the bitset current on byte class c,
+// epsilon closure included. Returns false if that set is empty.
+bool successorsNFA(NFA *nfa, const uint64_t *current, int c, uint64_t *next)
+{
+    int words = nfa->numWords;
+    memset(next, 0, sizeof(uint64_t) * words);
+    for (int w = 0; w < words; w++)
+    {
+        for (uint64_t bits = current[w]; bits; bits &= bits - 1)
+        {
+            int row = (w * WORD_BITS + __builtin_ctzll(bits)) * nfa->numClasses + c;
+            if (nfa->successorMasks != NULL)
+            {
+                const uint64_t *mask = nfa->successorMasks + (size_t)row * words;
+                for (int k = 0; k < words; k++)
+                {
+                    next[k] |= mask[k];
+                }
+                continue;
+            }
+            for (int i = nfa->offsets[row]; i < nfa->offsets[row + 1]; i++)
+            {
+                orClosureNFA(nfa, next, nfa->targets[i]);
+            }
+        }
+    }
+
+    uint64_t any = 0;
+    for (int k = 0; k < words; k++)
+    {
+        any |= next[k];
+    }
+    return any != 0;
+}
+
+// Bit-parallel simulation: the active states are a bitset, and each step ORs
+// together the precomputed successor masks of the active states
+bool runNFABitset(NFA *nfa, const char *input)
+{
+    int words = nfa->numWords;
+    int numClasses = nfa->numClasses;
+    const uint64_t *masks = nfa->successorMasks;
+    uint64_t current[NFA_BITSET_STATES / WORD_BITS];
+    uint64_t next[NFA_BITSET_STATES / WORD_BITS];
+    memcpy(current, nfa->epsilonClosures, sizeof(uint64_t) * words);
+
+    if (words == 1)
+    {
+        // One word covers every state, so the sets live in registers
+        uint64_t set = current[0];
+        for (const unsigned char *p = (const unsigned char *)input; *p && set; p++)
+        {
+            const uint64_t *column = masks + nfa->byteClass[*p];
+            uint64_t nextSet = 0;
+            for (uint64_t bits = set; bits; bits &= bits - 1)
+            {
+                nextSet |= column[__builtin_ctzll(bits) * numClasses];
+            }
+            set = nextSet;
+        }
+        return (set & nfa->finalMask[0]) != 0;
+    }
+
+    for (const unsigned char *p = (const unsigned char *)input; *p; p++)
+    {
+        int c = nfa->byteClass[*p];
+        uint64_t any = 0;
+        memset(next, 0, sizeof(uint64_t) * words);
+        for (int w = 0; w < words; w++)
+        {
+            for (uint64_t bits = current[w]; bits; bits &= bits - 1)
+            {
+                int s = w * WORD_BITS + __builtin_ctzll(bits);
+                const uint64_t *mask = masks + ((size_t)s * numClasses + c) * words;
+                for (int k = 0; k < words; k++)
+                {
+                    next[k] |= mask[k];
+                }
+            }
+        }
+        for (int k = 0; k < words; k++)
+        {
+            any |= current[k] = next[k];
+        }
+        if (!any)
+            return false;
+    }
+
+    for (int k = 0; k < words; k++)
+    {
+        if (current[k] & nfa->finalMask[k])
+            return true;
+    }
+    return false;
+}
+
+bool runNFA(NFA *nfa, const char *input)
+{
+    if (!nfa->finalized)
+        finalizeNFA(nfa);
+    if (nfa->successorMasks != NULL)
+        return runNFABitset(nfa, input);
+
+    // Too many states for successor masks: follow the sparse rows and add the
+    // epsilon closure of each target
+    int words = nfa->numWords;
+    uint64_t *currentStates = checkedCalloc(words, sizeof(uint64_t));
+    uint64_t *nextStates = checkedCalloc(words, sizeof(uint64_t));
+
+    // Initialize with start state
+    orClosureNFA(nfa, currentStates, 0);
+
+    // Process each input character
+    bool result = true;
+    while (*input && result)
+    {
+        result = successorsNFA(nfa, currentStates, nfa->byteClass[(unsigned char)*input], nextStates);
+
+        uint64_t *swap = currentStates;
+        currentStates = nextStates;
+        nextStates = swap;
+        input++;
+    }
+
+    // Check if final state
+    if (result)
+    {
+        uint64_t common = 0;
+        for (int k = 0; k < words; k++)
+        {
+            common |= currentStates[k] & nfa->finalMask[k];
+        }
+        result = common != 0;
+    }
+
+    free(currentStates);
+    free(nextStates);
+    return result;
+}
+
+void nfaREPL(NFA *nfa)
+{
+    char input[MAX_INPUT_LENGTH];
+    printf("Enter strings to test (or 'quit' to exit):\n");
+    while (1)
+    {
+        printf("Enter a string: ");
+        if (fgets(input, sizeof(input), stdin) == NULL)
+        {
+            break;
+        }
+
+        size_t len = strlen(input);
+        if (len > 0 && input[len - 1] == '\n')
+        {
+            input[len - 1] = '\0';
+            len--;
+        }
+
+        if (strcmp(input, "quit") == 0)
+            break;
+
+        bool result = runNFA(nfa, input);
+        printf("Input '%s' is %s\n", input, result ? "accepted" : "rejected");
+        printf("\n");
+    }
+    printf("\n");
+}
+
+NFA *NFAStringsEndingInGH()
+{
+    int finalStates[] = {2};
+    NFA *nfa = createNFA(3, 1, finalStates);
+
+    addTransitionNFA(nfa, 0, 'g', 1);
+
+    addTransitionNFA(nfa, 1, 'h', 2);
+
+    for (int c = 0; c < 128; c++)
+    {
+        if (c != 'g')
+        {
+            addTransitionNFA(nfa, 0, c, 0);
+        }
+        if (c != 'h')
+        {
+            addTransitionNFA(nfa, 1, c, 0); // Changed from 1 to 0
+        }
+        if (c != 'g')
+        {
+            addTransitionNFA(nfa, 2, c, 0); // Changed from 2 to 0
+        }
+        else
+        {
+            addTransitionNFA(nfa, 2, 'g', 1);
+        }
+    }
+
+    return nfa;
+}
+
+NFA *NFAStringsContainingMoo()
+{
+    int finalStates[] = {3};
+    NFA *nfa = createNFA(4, 1, finalStates);
+
+    // State 0: Initial state
+    // State 1: Seen 'm'
+    // State 2: Seen 'mo'
+    // State 3: Seen 'moo' (accepting state)
+
+    for (int c = 0; c < 128; c++)
+    {
+        addTransitionNFA(nfa, 0, c, 0);
+    }
+    addTransitionNFA(nfa, 0, 'm', 1);
+
+    for (int c = 0; c < 128; c++)
+    {
+        addTransitionNFA(nfa, 1, c, 0);
+    }
+    addTransitionNFA(nfa, 1, 'o', 2);
+
+    for (int c = 0; c < 128; c++)
+    {
+        addTransitionNFA(nfa, 2, c, 0);
+    }
+    addTransitionNFA(nfa, 2, 'o', 3);
+
+    for (int c = 0; c < 128; c++)
+    {
+        addTransitionNFA(nfa, 3, c, 3);
+    }
+
+    return nfa;
+}
+
+NFA *NFASpecialString()
+{                                          // >1 'a' or 'i' || >2 'y' || >3 'c' or 'l'
+    int finalStates[] = {2, 4, 7, 11, 15}; // Accept states for each condition
+    NFA *nfa = createNFA(16, 5, finalStates);
+
+    // States: 0 (start), 1-2 (a), 3-4 (i), 5-7 (y), 8-11 (c), 12-15 (l)
+
+    // Transitions for counting 'a'
+    addTransitionNFA(nfa, 0, 'a', 1);
+    addTransitionNFA(nfa, 1, 'a', 2);
+
+    // Transitions for counting 'i'
+    addTransitionNFA(nfa, 0, 'i', 3);
+    addTransitionNFA(nfa, 3, 'i', 4);
+
+    // Transitions for counting 'y'
+    addTransitionNFA(nfa, 0, 'y', 5);
+    addTransitionNFA(nfa, 5, 'y', 6);
+    addTransitionNFA(nfa, 6, 'y', 7);
+
+    // Transitions for counting 'c'
+    addTransitionNFA(nfa, 0, 'c', 8);
+    addTransitionNFA(nfa, 8, 'c', 9);
+    addTransitionNFA(nfa, 9, 'c', 10);
+    addTransitionNFA(nfa, 10, 'c', 11);
+
+    // Transitions for counting 'l'
+    addTransitionNFA(nfa, 0, 'l', 12);
+    addTransitionNFA(nfa, 12, 'l', 13);
+    addTransitionNFA(nfa, 13, 'l', 14);
+    addTransitionNFA(nfa, 14, 'l', 15);
+
+    // Self-loops for all states
+    for (int s = 0; s < 16; s++)
+    {
+        for (int c = 0; c < 128; c++)
+        {
+            addTransitionNFA(nfa, s, c, s);
+        }
+    }
+
+    return nfa;
+}
+
+// Regular expressions, compiled to NFAs by Thompson's construction. The
+// pattern must match the whole input, so use .*word.* for "contains word".
+// Supported syntax:
+//   ab       concatenation          a|b      alternation
+//   a* a+ a? repetition             a{m} a{m,} a{m,n}  counted repetition
+//   (ab)     grouping               .        any byte except newline
+//   [abc] [a-z] [^...]  classes     \d \w \s \D \W \S  class shorthands
+//   \n \t \r \f \v \xHH  escapes    \c       any other byte c, literally
+#define REGEX_MAX_REPEAT 1000
+
+// finalizeNFA keeps an epsilon closure bitset per state, n^2 bits in all, so
+// this caps that at 128 MB for an untrusted pattern
+#define REGEX_MAX_STATES (1 << 15)
+
+// Groups add no states, so nesting is limited separately to keep the
+// recursive parser off the end of the stack
+#define REGEX_MAX_DEPTH 256
+
+typedef enum
+{
+    REGEX_EMPTY,
+    REGEX_BYTES,
+    REGEX_CONCAT,
+    REGEX_ALTERNATE,
+    REGEX_REPEAT
+} RegexNodeType;
+
+typedef struct
+{
+    RegexNodeType type;
+    uint64_t bytes[NUM_BYTES / WORD_BITS]; // REGEX_BYTES
+    int left, right;                       // children; REGEX_REPEAT uses left
+    int min, max;                          // REGEX_REPEAT; max is -1 if unbounded
+    long long size;                        // NFA states the node compiles to
+} RegexNode;
+
+typedef struct
+{
+    const char *pattern;
+    const char *p;
+    const char *error;
+    RegexNode *nodes;
+    int numNodes;
+    int nodeCapacity;
+    int depth; // groups open at p
+} RegexParser;
+
+int addRegexNode(RegexParser *parser, RegexNodeType type, int left, int right)
+{
+    if (parser->numNodes == parser->nodeCapacity)
+    {
+        parser->nodeCapacity = parser->nodeCapacity > 0 ? parser->nodeCapacity * 2 : 64;
+        parser->nodes = checkedRealloc(parser->nodes, sizeof(RegexNode) * parser->nodeCapacity);
+    }
+    RegexNode *node = &parser->nodes[parser->numNodes];
+    memset(node, 0, sizeof(RegexNode));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    switch (type)
+    {
+    case REGEX_EMPTY:
+        node->size = 1;
+        break;
+    case REGEX_BYTES:
+        node->size = 2;
+        break;
+    case REGEX_CONCAT:
+        node->size = parser->nodes[left].size + parser->nodes[right].size;
+        break;
+    case REGEX_ALTERNATE:
+        node->size = parser->nodes[left].size + parser->nodes[right].size + 2;
+        break;
+    case REGEX_REPEAT:
+        break; // set by the caller once min and max are known
+    }
+    return parser->numNodes++;
+}
+
+// Records the first error and returns -1 for the parse functions to pass up
+int regexError(RegexParser *parser, const char *message)
+{
+    if (parser->error == NULL)
+        parser->error = message;
+    return -1;
+}
+
+void addByteRange(uint64_t *bytes, int from, int to)
+{
+    for (int c = from; c <= to; c++)
+    {
+        bytes[c / WORD_BITS] |= 1ULL << (c % WORD_BITS);
+    }
+}
+
+int hexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Parses the escape after a backslash into bytes. Returns false on a bad
+// escape. A single byte is also stored in *single (or -1 for a shorthand
+// class) so that class ranges can use it as an endpoint.
+bool parseRegexEscape(RegexParser *parser, uint64_t *bytes, int *single)
+{
+    char c = *parser->p;
+    if (c == '\0')
+    {
+        regexError(parser, "trailing backslash");
+        return false;
+    }
+    parser->p++;
+
+    uint64_t shorthand[NUM_BYTES / WORD_BITS] = {0};
+    bool negate = false;
+    *single = -1;
+    switch (c)
+    {
+    case 'D':
+        negate = true;
+        // fall through
+    case 'd':
+        addByteRange(shorthand, '0', '9');
+        break;
+    case 'W':
+        negate = true;
+        // fall through
+    case 'w':
+        addByteRange(shorthand, '0', '9');
+        addByteRange(shorthand, 'A', 'Z');
+        addByteRange(shorthand, 'a', 'z');
+        addByteRange(shorthand, '_', '_');
+        break;
+    case 'S':
+        negate = true;
+        // fall through
+    case 's':
+        addByteRange(shorthand, '\t', '\r');
+        addByteRange(shorthand, ' ', ' ');
+        break;
+    case 'n':
+        *single = '\n';
+        break;
+    case 't':
+        *single = '\t';
+        break;
+    case 'r':
+        *single = '\r';
+        break;
+    case 'f':
+        *single = '\f';
+        break;
+    case 'v':
+        *single = '\v';
+        break;
+    case 'x':
+    {
+        int high = hexDigitValue(parser->p[0]);
+        int low = high < 0 ? -1 : hexDigitValue(parser->p[1]);
+        if (low < 0)
+        {
+            regexError(parser, "\\x needs two hex digits");
+            return false;
+        }
+        parser->p += 2;
+        *single = high * 16 + low;
+        break;
+    }
+    default:
+        *single = (unsigned char)c;
+        break;
+    }
+
+    if (*single >= 0)
+    {
+        addByteRange(bytes, *single, *single);
+        return true;
+    }
+    for (int w = 0; w < NUM_BYTES / WORD_BITS; w++)
+    {
+        bytes[w] |= negate ? ~shorthand[w] : shorthand[w];
+    }
+    return true;
+}
+
+// class := '[' '^'? ']'? (item | item '-' item)* ']', after the '['
+bool parseRegexClass(RegexParser *parser, uint64_t *bytes)
+{
+    bool negate = false;
+    if (*parser->p == '^')
+    {
+        negate = true;
+        parser->p++;
+    }
+
+    bool first = true;
+    while (*parser->p != ']' || first)
+    {
+        if (*parser->p == '\0')
+        {
+            regexError(parser, "missing ]");
+            return false;
+        }
+        first = false;
+
+        int low;
+        if (*parser->p == '\\')
+        {
+            parser->p++;
+            if (!parseRegexEscape(parser, bytes, &low))
+                return false;
+            if (low < 0)
+                continue; // shorthand classes cannot start a range
+        }
+        else
+        {
+            low = (unsigned char)*parser->p++;
+            addByteRange(bytes, low, low);
+        }
+
+        if (parser->p[0] != '-' || parser->p[1] == ']' || parser->p[1] == '\0')
+            continue;
+        parser->p++;
+        int high;
+        if (*parser->p == '\\')
+        {
+            parser->p++;
+            uint64_t ignored[NUM_BYTES / WORD_BITS] = {0};
+            if (!parseRegexEscape(parser, ignored, &high))
+                return false;
+            if (high < 0)
+            {
+                regexError(parser, "class shorthand cannot end a range");
+                return false;
+            }
+        }
+        else
+        {
+            high = (unsigned char)*parser->p++;
+        }
+        if (high < low)
+        {
+            regexError(parser, "range out of order");
+            return false;
+        }
+        addByteRange(bytes, low, high);
+    }
+    parser->p++;
+
+    if (negate)
+    {
+        for (int w = 0; w < NUM_BYTES / WORD_BITS; w++)
+        {
+            bytes[w] = ~bytes[w];
+        }
+    }
+    return true;
+}
+
+int parseRegexAlternation(RegexParser *parser);
+
+// atom := '(' alternation ')' | '[' class ']' | '.' | '\' escape | byte
+int parseRegexAtom(RegexParser *parser)
+{
+    char c = *parser->p;
+    if (c == '(')
+    {
+        if (++parser->depth > REGEX_MAX_DEPTH)
+            return regexError(parser, "pattern is nested too deeply");
+        parser->p++;
+        int node = parseRegexAlternation(parser);
+        if (node < 0)
+            return -1;
+        if (*parser->p != ')')
+            return regexError(parser, "missing )");
+        parser->p++;
+        parser->depth--;
+        return node;
+    }
+    if (c == '*' || c == '+' || c == '?' || c == '{')
+        return regexError(parser, "nothing to repeat");
+
+    uint64_t bytes[NUM_BYTES / WORD_BITS] = {0};
+    parser->p++;
+    if (c == '[')
+    {
+        if (!parseRegexClass(parser, bytes))
+            return -1;
+    }
+    else if (c == '.')
+    {
+        addByteRange(bytes, 0, NUM_BYTES - 1);
+        bytes['\n' / WORD_BITS] &= ~(1ULL << ('\n' % WORD_BITS));
+    }
+    else if (c == '\\')
+    {
+        int single;
+        if (!parseRegexEscape(parser, bytes, &single))
+            return -1;
+    }
+    else
+    {
+        addByteRange(bytes, (unsigned char)c, (unsigned char)c);
+    }
+
+    int node = addRegexNode(parser, REGEX_BYTES, -1, -1);
+    memcpy(parser->nodes[node].bytes, bytes, sizeof(bytes));
+    return node;
+}
+
+// Reads a decimal count for {m,n}, or returns -1 if there are no digits
+int parseRegexCount(RegexParser *parser)
+{
+    if (*parser->p < '0' || *parser->p > '9')
+        return -1;
+    int value = 0;
+    while (*parser->p >= '0' && *parser->p <= '9')
+    {
+        if (value <= REGEX_MAX_REPEAT)
+            value = value * 10 + (*parser->p - '0');
+        parser->p++;
+    }
+    return value;
+}
+
+// repeat := atom ('*' | '+' | '?' | '{' m '}' | '{' m ',' '}' | '{' m ',' n '}')*
+int parseRegexRepeat(RegexParser *parser)
+{
+    int node = parseRegexAtom(parser);
+    while (node >= 0)
+    {
+        int min, max;
+        char c = *parser->p;
+        if (c == '*' || c == '+' || c == '?')
+        {
+            parser->p++;
+            min = c == '+' ? 1 : 0;
+            max = c == '?' ? 1 : -1;
+        }
+        else if (c == '{')
+        {
+            parser->p++;
+            min = parseRegexCount(parser);
+            if (min < 0)
+                return regexError(parser, "expected a count after {");
+            max = min;
+            if (*parser->p == ',')
+            {
+                parser->p++;
+                max = *parser->p == '}' ? -1 : parseRegexCount(parser);
+                if (max == -1 && *parser->p != '}')
+                    return regexError(parser, "expected a count or } after ,");
+            }
+            if (*parser->p != '}')
+                return regexError(parser, "missing }");
+            parser->p++;
+            if (min > REGEX_MAX_REPEAT || max > REGEX_MAX_REPEAT)
+                return regexError(parser, "repetition count too large");
+            if (max != -1 && max < min)
+                return regexError(parser, "repetition range out of order");
+        }
+        else
+        {
+            break;
+        }
+
+        long long child = parser->nodes[node].size;
+        node = addRegexNode(parser, REGEX_REPEAT, node, -1);
+        RegexNode *repeat = &parser->nodes[node];
+        repeat->min = min;
+        repeat->max = max;
+        // The entry state, the copies and, when some copies are optional, the
+        // exit state they may skip to; compileRegexNode builds exactly these
+        repeat->size = 1 + min * child + (max == -1 ? child : (max - min) * child + (max > min));
+        if (repeat->size > REGEX_MAX_STATES)
+            return regexError(parser, "pattern is too large");
+    }
+    return node;
+}
+
+// concat := repeat*
+int parseRegexConcat(RegexParser *parser)
+{
+    int node = -1;
+    while (*parser->p != '\0' && *parser->p != '|' && *parser->p != ')')
+    {
+        int next = parseRegexRepeat(parser);
+        if (next < 0)
+            return -1;
+        node = node < 0 ? next : addRegexNode(parser, REGEX_CONCAT, node, next);
+        if (parser->nodes[node].size > REGEX_MAX_STATES)
+            return regexError(parser, "pattern is too large");
+    }
+    return node < 0 ? addRegexNode(parser, REGEX_EMPTY, -1, -1) : node;
+}
+
+// alternation := concat ('|' concat)*
+int parseRegexAlternation(RegexParser *parser)
+{
+    int node = parseRegexConcat(parser);
+    while (node >= 0 && *parser->p == '|')
+    {
+        parser->p++;
+        int next = parseRegexConcat(parser);
+        if (next < 0)
+            return -1;
+        node = addRegexNode(parser, REGEX_ALTERNATE, node, next);
+        if (parser->nodes[node].size > REGEX_MAX_STATES)
+            return regexError(parser, "pattern is too large");
+    }
+    return node;
+}
+
+// Emits the Thompson fragment for a node into the NFA. A fragment has one
+// entry and one exit state, and every transition between them stays inside.
+// The parser's size estimates keep patterns within REGEX_MAX_STATES, but the
+// real count is checked too, so that a wrong estimate fails with an error
+// instead of building an NFA too large to finalize.
+void compileRegexNode(RegexParser *parser, int index, NFA *nfa, int *start, int *end)
+{
+    if (nfa->numStates > REGEX_MAX_STATES)
+        regexError(parser, "pattern is too large");
+    if (parser->error != NULL)
+    {
+        *start = *end = 0;
+        return;
+    }
+
+    RegexNode *node = &parser->nodes[index];
+    switch (node->type)
+    {
+    case REGEX_EMPTY:
+        *start = *end = nfa->numStates++;
+        break;
+    case REGEX_BYTES:
+        *start = nfa->numStates++;
+        *end = nfa->numStates++;
+        for (int c = 0; c < NUM_BYTES; c++)
+        {
+            if (node->bytes[c / WORD_BITS] >> (c % WORD_BITS) & 1)
+                addTransitionNFA(nfa, *start, c, *end);
+        }
+        break;
+    case REGEX_CONCAT:
+    {
+        int middle, next;
+        compileRegexNode(parser, node->left, nfa, start, &middle);
+        compileRegexNode(parser, node->right, nfa, &next, end);
+        addEpsilonTransition(nfa, middle, next);
+        break;
+    }
+    case REGEX_ALTERNATE:
+    {
+        int leftStart, leftEnd, rightStart, rightEnd;
+        *start = nfa->numStates++;
+        compileRegexNode(parser, node->left, nfa, &leftStart, &leftEnd);
+        compileRegexNode(parser, node->right, nfa, &rightStart, &rightEnd);
+        *end = nfa->numStates++;
+        addEpsilonTransition(nfa, *start, leftStart);
+        addEpsilonTransition(nfa, *start, rightStart);
+        addEpsilonTransition(nfa, leftEnd, *end);
+        addEpsilonTransition(nfa, rightEnd, *end);
+        break;
+    }
+    case REGEX_REPEAT:
+    {
+        // min required copies, then either a loop or max - min copies that
+        // may each be skipped
+        int min = node->min, max = node->max, child = node->left;
+        int copyStart, copyEnd;
+        *start = *end = nfa->numStates++;
+        for (int i = 0; i < min; i++)
+        {
+            compileRegexNode(parser, child, nfa, &copyStart, &copyEnd);
+            addEpsilonTransition(nfa, *end, copyStart);
+            *end = copyEnd;
+        }
+        if (max == -1)
+        {
+            compileRegexNode(parser, child, nfa, &copyStart, &copyEnd);
+            addEpsilonTransition(nfa, *end, copyStart);
+            addEpsilonTransition(nfa, copyEnd, *end);
+        }
+        else if (max > min)
+        {
+            int exit = nfa->numStates++;
+            for (int i = min; i < max; i++)
+            {
+                compileRegexNode(parser, child, nfa, &copyStart, &copyEnd);
+                addEpsilonTransition(nfa, *end, exit);
+                addEpsilonTransition(nfa, *end, copyStart);
+                *end = copyEnd;
+            }
+            addEpsilonTransition(nfa, *end, exit);
+            *end = exit;
+        }
+        break;
+    }
+    }
+}
+
+// Compiles a pattern into an NFA whose start state is 0 and that accepts the
+// inputs the whole pattern matches. Returns NULL and reports the position of
+// the problem on stderr if the pattern is malformed.
+NFA *compileRegex(const char *pattern)
+{
+    RegexParser parser = {pattern, pattern, NULL, NULL, 0, 0, 0};
+    int root = parseRegexAlternation(&parser);
+    if (root >= 0 && *parser.p != '\0')
+        regexError(&parser, "unmatched )");
+    if (parser.error != NULL)
+    {
+        fprintf(stderr, "Bad regex '%s' at offset %d: %s\n",
+                pattern, (int)(parser.p - pattern), parser.error);
+        free(parser.nodes);
+        return NULL;
+    }
+
+    NFA *nfa = createNFA(1, 0, NULL);
+    int start, end;
+    compileRegexNode(&parser, root, nfa, &start, &end);
+    if (parser.error != NULL)
+    {
+        fprintf(stderr, "Bad regex '%s': %s\n", pattern, parser.error);
+        freeNFA(nfa);
+        free(parser.nodes);
+        return NULL;
+    }
+    addEpsilonTransition(nfa, 0, start);
+    addFinalStateNFA(nfa, end);
+
+    free(parser.nodes);
+    return nfa;
+}
+
+DFA *createDFAForStringsEndingInGH()
+{
+    printf("Creating DFA for strings ending in 'gh'...\n");
+    int finalStates[] = {2};
+    DFA *dfa = createDFA(3, 1, finalStates);
+
+    // State 0: Initial state
+    // State 1: Seen 'g'
+    // State 2: Seen 'gh' (accepting state)
+
+    // Add transitions
+    for (int c = 0; c < 128; c++)
+    {
+        addTransitionDFA(dfa, 0, c, 0); // Stay in state 0 for all inputs except 'g'
+        addTransitionDFA(dfa, 1, c, 0); // Go back to state 0 for all inputs except 'h'
+        addTransitionDFA(dfa, 2, c, 0); // Go back to state 0 for all inputs
+    }
+
+    addTransitionDFA(dfa, 0, 'g', 1); // Go to state 1 when 'g' is seen
+    addTransitionDFA(dfa, 1, 'h', 2); // Go to state 2 when 'h' is seen after 'g'
+    addTransitionDFA(dfa, 2, 'g', 1); // Allow 'g' to start a new potential match
+
+    printf("DFA created with %d states.\n", dfa->numStates);
+    return dfa;
+}
+
+// How much memory a DFA built from an untrusted pattern may take, counting
+// the construction tables as well as the DFA itself
+#define DFA_MEMORY_BUDGET ((size_t)256 << 20)
+
+// Rough bytes per state while a DFA is being built: its row of the build
+// table, its key of keyWords words and its hash slots
+size_t bytesPerStateDFA(int keyWords)
+{
+    return sizeof(int) * NUM_BYTES + sizeof(uint64_t) * keyWords + 2 * sizeof(int);
+}
+
+// Largest number of states that fit in budget bytes at bytesPerState each
+int statesInBudget(size_t budget, size_t bytesPerState)
+{
+    size_t states = budget / bytesPerState;
+    return states < INT32_MAX ? (int)states : INT32_MAX;
+}
+
+// Subset construction. Each DFA state is a set of NFA states kept as a bitset,
+// and a hash table maps each set to its DFA state, so looking up a subset
+// costs one hash and one comparison. Gives up and returns NULL once the DFA
+// would take more than about budget bytes, which for some NFAs happens long
+// before it is finished: n NFA states can need 2^n DFA states.
+DFA *NFA_to_DFALimited(NFA *nfa, size_t budget)
+{
+    if (!nfa->finalized)
+        finalizeNFA(nfa);
+
+    int words = nfa->numWords;
+    int maxStates = statesInBudget(budget, bytesPerStateDFA(words));
+    SetTable *dfaStates = createSetTable(words);
+    uint64_t *currentSet = checkedRealloc(NULL, sizeof(uint64_t) * words);
+    uint64_t *nextSet = checkedRealloc(NULL, sizeof(uint64_t) * words);
+
+    // Target DFA state for each byte class of the state being processed
+    int *classTarget = checkedRealloc(NULL, sizeof(int) * nfa->numClasses);
+
+    memset(currentSet, 0, sizeof(uint64_t) * words);
+    orClosureNFA(nfa, currentSet, 0);
+    findOrAddSet(dfaStates, currentSet);
+
+    DFA *dfa = createDFA(1, 0, NULL);
+
+    bool tooLarge = false;
+    for (int processingState = 0; processingState < dfaStates->count && !tooLarge; processingState++)
+    {
+        memcpy(currentSet, setTableKey(dfaStates, processingState), sizeof(uint64_t) * words);
+
+        // Bytes in the same class lead to the same set, so each class is
+        // computed once
+        for (int c = 0; c < nfa->numClasses; c++)
+        {
+            classTarget[c] = -1;
+            if (successorsNFA(nfa, currentSet, c, nextSet))
+                classTarget[c] = findOrAddSet(dfaStates, nextSet);
+        }
+
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            if (classTarget[nfa->byteClass[x]] != -1)
+                addTransitionDFA(dfa, processingState, x, classTarget[nfa->byteClass[x]]);
+        }
+        tooLarge = dfaStates->count > maxStates;
+    }
+
+    if (tooLarge)
+    {
+        freeDFA(dfa);
+        dfa = NULL;
+    }
+
+    // A DFA state is final if its set contains a final NFA state
+    for (int i = 0; i < dfaStates->count && dfa != NULL; i++)
+    {
+        const uint64_t *set = setTableKey(dfaStates, i);
+        for (int k = 0; k < words; k++)
+        {
+            if (set[k] & nfa->finalMask[k])
+            {
+                addFinalStateDFA(dfa, i);
+                break;
+            }
+        }
+    }
+
+    if (dfa != NULL)
+        dfa->numStates = dfaStates->count;
+
+    freeSetTable(dfaStates);
+    free(currentSet);
+    free(nextSet);
+    free(classTarget);
+
+    return dfa;
+}
+
+// Subset construction without a budget, for the trusted built-in NFAs
+DFA *NFA_to_DFA(NFA *nfa)
+{
+    return NFA_to_DFALimited(nfa, SIZE_MAX);
+}
+
+// Lazily built DFA: DFA states are made from the NFA only when the input
+// reaches them, and at most maxStates of them are cached. When the cache is
+// full it is flushed and rebuilt from the state being processed, so memory
+// stays bounded however many states the full DFA would have.
+typedef struct
+{
+    NFA *nfa;
+    int maxStates;
+    int startState;   // cached id of the start set, or -1 after a flush
+    SetTable *states; // NFA state set of each cached DFA state
+    int *transitions; // maxStates x numClasses; LAZY_UNKNOWN until computed, -1 if dead
+    bool *accepting;
+    uint64_t *currentSet;
+    uint64_t *nextSet;
+    int flushes;
+} LazyDFA;
+
+#define LAZY_UNKNOWN -2
+
+// If the cache is flushed more than once while scanning this many bytes per
+// cached state, it is too small for the input and runLazyDFA falls back to
+// simulating the NFA directly
+#define LAZY_BYTES_PER_STATE 8
+
+LazyDFA *createLazyDFA(NFA *nfa, int maxStates)
+{
+    if (!nfa->finalized)
+        finalizeNFA(nfa);
+
+    LazyDFA *lazy = checkedCalloc(1, sizeof(LazyDFA));
+    lazy->nfa = nfa;
+    lazy->maxStates = maxStates > 1 ? maxStates : 2;
+    lazy->startState = -1;
+    lazy->states = createSetTable(nfa->numWords);
+    lazy->transitions = checkedRealloc(NULL, sizeof(int) * lazy->maxStates * nfa->numClasses);
+    lazy->accepting = checkedRealloc(NULL, sizeof(bool) * lazy->maxStates);
+    lazy->currentSet = checkedRealloc(NULL, sizeof(uint64_t) * nfa->numWords);
+    lazy->nextSet = checkedRealloc(NULL, sizeof(uint64_t) * nfa->numWords);
+    return lazy;
+}
+
+void freeLazyDFA(LazyDFA *lazy)
+{
+    freeSetTable(lazy->states);
+    free(lazy->transitions);
+    free(lazy->accepting);
+    free(lazy->currentSet);
+    free(lazy->nextSet);
+    free(lazy);
+}
+
+// Returns the cached state for set, adding it if there is room. Returns -1 if
+// the cache is full.
+int addLazyState(LazyDFA *lazy, const uint64_t *set)
+{
+    int id = findSet(lazy->states, set);
+    if (id != -1 || lazy->states->count == lazy->maxStates)
+        return id;
+
+    NFA *nfa = lazy->nfa;
+    id = findOrAddSet(lazy->states, set);
+    for (int c = 0; c < nfa->numClasses; c++)
+    {
+        lazy->transitions[id * nfa->numClasses + c] = LAZY_UNKNOWN;
+    }
+    lazy->accepting[id] = false;
+    for (int k = 0; k < nfa->numWords; k++)
+    {
+        if (set[k] & nfa->finalMask[k])
+            lazy->accepting[id] = true;
+    }
+    return id;
+}
+
+void flushLazyDFA(LazyDFA *lazy)
+{
+    clearSetTable(lazy->states);
+    lazy->startState = -1;
+    lazy->flushes++;
+}
+
+int startLazyDFA(LazyDFA *lazy)
+{
+    if (lazy->startState == -1)
+    {
+        memset(lazy->currentSet, 0, sizeof(uint64_t) * lazy->nfa->numWords);
+        orClosureNFA(lazy->nfa, lazy->currentSet, 0);
+        lazy->startState = addLazyState(lazy, lazy->currentSet);
+        if (lazy->startState == -1)
+        {
+            flushLazyDFA(lazy);
+            lazy->startState = addLazyState(lazy, lazy->currentSet);
+        }
+    }
+    return lazy->startState;
+}
+
+// Computes the transition of cached state on class c from the NFA. If the
+// cache is full it is flushed first, and state is re-added to the fresh cache.
+int computeLazyTransition(LazyDFA *lazy, int state, int c)
+{
+    NFA *nfa = lazy->nfa;
+    memcpy(lazy->currentSet, setTableKey(lazy->states, state), sizeof(uint64_t) * nfa->numWords);
+    if (!successorsNFA(nfa, lazy->currentSet, c, lazy->nextSet))
+    {
+        lazy->transitions[state * nfa->numClasses + c] = -1;
+        return -1;
+    }
+
+    int next = addLazyState(lazy, lazy->nextSet);
+    if (next == -1)
+    {
+        flushLazyDFA(lazy);
+        state = addLazyState(lazy, lazy->currentSet);
+        next = addLazyState(lazy, lazy->nextSet);
+    }
+    lazy->transitions[state * nfa->numClasses + c] = next;
+    return next;
+}
+
+// Advances the lazy DFA from state over len bytes of buf, like stepDFA.
+// Returns the state reached, or -1 once no NFA state is active. State ids stay
+// valid across calls, since a flush re-adds the state being processed.
+int stepLazyDFA(LazyDFA *lazy, int state, const char *buf, size_t len)
+{
+    const unsigned char *byteClass = lazy->nfa->byteClass;
+    int numClasses = lazy->nfa->numClasses;
+    const unsigned char *p = (const unsigned char *)buf;
+    const unsigned char *end = p + len;
+    while (p < end && state != -1)
+    {
+        int c = byteClass[*p++];
+        int next = lazy->transitions[state * numClasses + c];
+        if (next == LAZY_UNKNOWN)
+            next = computeLazyTransition(lazy, state, c);
+        state = next;
+    }
+    return state;
+}
+
+// Whether the NFA accepts the len bytes at input, which may contain NUL bytes
+bool matchLazyDFA(LazyDFA *lazy, const char *input, size_t len)
+{
+    NFA *nfa = lazy->nfa;
+    size_t chunk = (size_t)lazy->maxStates * LAZY_BYTES_PER_STATE;
+    int state = startLazyDFA(lazy);
+
+    while (len > 0 && state != -1)
+    {
+        size_t n = len < chunk ? len : chunk;
+        int flushes = lazy->flushes;
+        state = stepLazyDFA(lazy, state, input, n);
+        input += n;
+        len -= n;
+
+        if (lazy->flushes > flushes + 1 && len > 0 && state != -1)
+        {
+            // The cache is thrashing, so finish with the NFA sets themselves
+            memcpy(lazy->currentSet, setTableKey(lazy->states, state), sizeof(uint64_t) * nfa->numWords);
+            bool alive = true;
+            for (const unsigned char *p = (const unsigned char *)input; alive && len > 0; p++, len--)
+            {
+                alive = successorsNFA(nfa, lazy->currentSet, nfa->byteClass[*p], lazy->nextSet);
+                uint64_t *swap = lazy->currentSet;
+                lazy->currentSet = lazy->nextSet;
+                lazy->nextSet = swap;
+            }
+            if (!alive)
+                return false;
+            for (int k = 0; k < nfa->numWords; k++)
+            {
+                if (lazy->currentSet[k] & nfa->finalMask[k])
+                    return true;
+            }
+            return false;
+        }
+    }
+    return state != -1 && lazy->accepting[state];
+}
+
+bool runLazyDFA(LazyDFA *lazy, const char *input)
+{
+    return matchLazyDFA(lazy, input, strlen(input));
+}
+
+// Sets *length to the longest prefix of buf the lazy DFA accepts, reading
+// only until the DFA dies. Returns false if it accepts no prefix.
+bool longestPrefixLazyDFA(LazyDFA *lazy, const char *buf, size_t len, size_t *length)
+{
+    int state = startLazyDFA(lazy);
+    bool matched = false;
+    for (size_t i = 0; state != -1; i++)
+    {
+        if (lazy->accepting[state])
+        {
+            matched = true;
+            *length = i;
+        }
+        if (i == len)
+            break;
+        state = stepLazyDFA(lazy, state, buf + i, 1);
+    }
+    return matched;
+}
+
+// Runs the lazy DFA over buf backwards, from its last byte to its first, and
+// sets accepted[i] to whether it accepts once it has read back to offset i,
+// for every i from len down to 0
+void acceptedBackwardsLazyDFA(LazyDFA *lazy, const char *buf, size_t len, bool *accepted)
+{
+    int state = startLazyDFA(lazy);
+    for (size_t i = len;; i--)
+    {
+        accepted[i] = state != -1 && lazy->accepting[state];
+        if (i == 0)
+            break;
+        if (state != -1)
+            state = stepLazyDFA(lazy, state, buf + i - 1, 1);
+    }
+}
+
+// qsort has no context argument, so compareInitialBlocks reads these
+static DFA *initialBlockDFA;
+static const int *initialBlockStates;
+
+// Orders the states of minimizeDFA by acceptance, then by pattern list
+int compareInitialBlocks(const void *a, const void *b)
+{
+    int s = initialBlockStates[*(const int *)a];
+    int t = initialBlockStates[*(const int *)b];
+    if (initialBlockDFA->accepting[s] != initialBlockDFA->accepting[t])
+        return initialBlockDFA->accepting[s] ? -1 : 1;
+
+    const int *sIds, *tIds;
+    int sCount = patternsDFA(initialBlockDFA, s, &sIds);
+    int tCount = patternsDFA(initialBlockDFA, t, &tIds);
+    if (sCount != tCount)
+        return sCount - tCount;
+    for (int i = 0; i < sCount; i++)
+    {
+        if (sIds[i] != tIds[i])
+            return sIds[i] - tIds[i];
+    }
+    return 0;
+}
+
+// Returns the minimal DFA for the same language (Hopcroft's algorithm). For a
+// multi-pattern DFA, states are only merged if they match the same patterns.
+// Unreachable states are dropped first. States that cannot reach a final state
+// end up in the same block as the dead state, and the transitions into that
+// block are left undefined, so dead states disappear as well. The input DFA is
+// not changed.
+DFA *minimizeDFA(DFA *dfa)
+{
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+
+    int numClasses = dfa->numClasses;
+    int dead = dfa->numStates;
+
+    // Number the states reachable from the start state; the dead state is
+    // always included so that the partition is over a complete DFA
+    int *index = checkedRealloc(NULL, sizeof(int) * (dead + 1));
+    int *state = checkedRealloc(NULL, sizeof(int) * (dead + 1));
+    for (int s = 0; s <= dead; s++)
+    {
+        index[s] = -1;
+    }
+    int n = 0;
+    index[0] = n;
+    state[n++] = 0;
+    if (index[dead] == -1)
+    {
+        index[dead] = n;
+        state[n++] = dead;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        for (int c = 0; c < numClasses; c++)
+        {
+            int t = scanEntryDFA(dfa, (size_t)state[i] * numClasses + c);
+            if (index[t] == -1)
+            {
+                index[t] = n;
+                state[n++] = t;
+            }
+        }
+    }
+
+    // Predecessors of each state on each class, as compressed rows:
+    // predecessors[predecessorStart[t * numClasses + c]] onwards
+    int rows = n * numClasses;
+    int *predecessorStart = checkedCalloc(rows + 1, sizeof(int));
+    int *predecessors = checkedRealloc(NULL, sizeof(int) * rows);
+    for (int i = 0; i < n; i++)
+    {
+        for (int c = 0; c < numClasses; c++)
+        {
+            int t = index[scanEntryDFA(dfa, (size_t)state[i] * numClasses + c)];
+            predecessorStart[t * numClasses + c + 1]++;
+        }
+    }
+    for (int r = 0; r < rows; r++)
+    {
+        predecessorStart[r + 1] += predecessorStart[r];
+    }
+    int *fill = checkedRealloc(NULL, sizeof(int) * rows);
+    memcpy(fill, predecessorStart, sizeof(int) * rows);
+    for (int i = 0; i < n; i++)
+    {
+        for (int c = 0; c < numClasses; c++)
+        {
+            int t = index[scanEntryDFA(dfa, (size_t)state[i] * numClasses + c)];
+            predecessors[fill[t * numClasses + c]++] = i;
+        }
+    }
+    free(fill);
+
+    // Refinable partition: the members of block b are elements[first[b]] up to
+    // elements[end[b]], and during a split the marked members are moved to the
+    // front, up to elements[marked[b]]
+    int *elements = checkedRealloc(NULL, sizeof(int) * n);
+    int *location = checkedRealloc(NULL, sizeof(int) * n);
+    int *block = checkedRealloc(NULL, sizeof(int) * n);
+    int *first = checkedRealloc(NULL, sizeof(int) * n);
+    int *end = checkedRealloc(NULL, sizeof(int) * n);
+    int *marked = checkedRealloc(NULL, sizeof(int) * n);
+    bool *waiting = checkedCalloc(n, sizeof(bool));
+    int *workList = checkedRealloc(NULL, sizeof(int) * n);
+    int *touched = checkedRealloc(NULL, sizeof(int) * n);
+    int *splitter = checkedRealloc(NULL, sizeof(int) * n);
+    int numBlocks = 0, workCount = 0;
+
+    // Initial partition: states with the same acceptance and the same pattern
+    // list start in the same block
+    for (int i = 0; i < n; i++)
+    {
+        elements[i] = i;
+    }
+    initialBlockDFA = dfa;
+    initialBlockStates = state;
+    qsort(elements, n, sizeof(int), compareInitialBlocks);
+    for (int k = 0; k < n; k++)
+    {
+        if (k == 0 || compareInitialBlocks(&elements[k - 1], &elements[k]) != 0)
+        {
+            first[numBlocks] = marked[numBlocks] = k;
+            numBlocks++;
+        }
+        end[numBlocks - 1] = k + 1;
+        location[elements[k]] = k;
+        block[elements[k]] = numBlocks - 1;
+    }
+
+    for (int b = 0; b < numBlocks; b++)
+    {
+        waiting[b] = true;
+        workList[workCount++] = b;
+    }
+
+    while (workCount > 0)
+    {
+        int a = workList[--workCount];
+        waiting[a] = false;
+
+        // Copy the splitter, since splitting can move its members around
+        int size = end[a] - first[a];
+        memcpy(splitter, elements + first[a], sizeof(int) * size);
+
+        for (int c = 0; c < numClasses; c++)
+        {
+            int numTouched = 0;
+            for (int k = 0; k < size; k++)
+            {
+                int t = splitter[k];
+                for (int j = predecessorStart[t * numClasses + c]; j < predecessorStart[t * numClasses + c + 1]; j++)
+                {
+                    int p = predecessors[j];
+                    int b = block[p];
+                    if (location[p] < marked[b])
+                        continue;
+                    if (marked[b] == first[b])
+                        touched[numTouched++] = b;
+
+                    // Swap p into the marked part of its block
+                    int other = elements[marked[b]];
+                    elements[location[p]] = other;
+                    location[other] = location[p];
+                    elements[marked[b]] = p;
+                    location[p] = marked[b]++;
+                }
+            }
+
+            for (int k = 0; k < numTouched; k++)
+            {
+                int b = touched[k];
+                if (marked[b] == end[b])
+                {
+                    marked[b] = first[b];
+                    continue;
+                }
+
+                // The marked members become a new block
+                int nb = numBlocks++;
+                first[nb] = marked[nb] = first[b];
+                end[nb] = marked[b];
+                first[b] = marked[b];
+                for (int i = first[nb]; i < end[nb]; i++)
+                {
+                    block[elements[i]] = nb;
+                }
+
+                if (waiting[b] || end[nb] - first[nb] <= end[b] - first[b])
+                {
+                    waiting[nb] = true;
+                    workList[workCount++] = nb;
+                }
+                else
+                {
+                    waiting[b] = true;
+                    workList[workCount++] = b;
+                }
+            }
+        }
+    }
+
+    // Number the blocks from the start block, leaving out the dead block
+    int deadBlock = block[index[dead]];
+    int *blockState = checkedRealloc(NULL, sizeof(int) * numBlocks);
+    int *representative = checkedRealloc(NULL, sizeof(int) * numBlocks);
+    for (int b = 0; b < numBlocks; b++)
+    {
+        blockState[b] = -1;
+    }
+    int numStates = 0;
+    if (block[0] != deadBlock)
+    {
+        blockState[block[0]] = numStates;
+        representative[numStates++] = block[0];
+    }
+    for (int i = 0; i < numStates; i++)
+    {
+        int s = state[elements[first[representative[i]]]];
+        for (int c = 0; c < numClasses; c++)
+        {
+            int t = block[index[scanEntryDFA(dfa, (size_t)s * numClasses + c)]];
+            if (t != deadBlock && blockState[t] == -1)
+            {
+                blockState[t] = numStates;
+                representative[numStates++] = t;
+            }
+        }
+    }
+
+    DFA *minimal = createDFA(numStates > 0 ? numStates : 1, 0, NULL);
+    if (dfa->patternStart != NULL)
+    {
+        minimal->numPatterns = dfa->numPatterns;
+        minimal->patternStart = checkedCalloc(minimal->numStates + 1, sizeof(int));
+        for (int i = 0; i < numStates; i++)
+        {
+            const int *ids;
+            int count = patternsDFA(dfa, state[elements[first[representative[i]]]], &ids);
+            minimal->patternStart[i + 1] = minimal->patternStart[i] + count;
+        }
+        minimal->patternIds = checkedRealloc(NULL, sizeof(int) * minimal->patternStart[minimal->numStates]);
+        for (int i = 0; i < numStates; i++)
+        {
+            const int *ids;
+            int count = patternsDFA(dfa, state[elements[first[representative[i]]]], &ids);
+            memcpy(minimal->patternIds + minimal->patternStart[i], ids, sizeof(int) * count);
+        }
+    }
+    for (int i = 0; i < numStates; i++)
+    {
+        int s = state[elements[first[representative[i]]]];
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            int t = block[index[scanEntryDFA(dfa, (size_t)s * numClasses + dfa->byteClass[x])]];
+            if (t != deadBlock)
+                addTransitionDFA(minimal, i, x, blockState[t]);
+        }
+        if (dfa->accepting[s])
+            addFinalStateDFA(minimal, i);
+    }
+
+    free(index);
+    free(state);
+    free(predecessorStart);
+    free(predecessors);
+    free(elements);
+    free(location);
+    free(block);
+    free(first);
+    free(end);
+    free(marked);
+    free(waiting);
+    free(workList);
+    free(touched);
+    free(splitter);
+    free(blockState);
+    free(representative);
+    return minimal;
+}
+
+// qsort has no context argument, so compareVisits reads this
+static const long *visitCounts;
+
+// Orders states by visit count, most visited first, then by id
+int compareVisits(const void *a, const void *b)
+{
+    int s = *(const int *)a, t = *(const int *)b;
+    if (visitCounts[s] != visitCounts[t])
+        return visitCounts[s] > visitCounts[t] ? -1 : 1;
+    return s - t;
+}
+
+// Returns a copy of dfa with its states renumbered by how often matching the
+// sample inputs visits them, so that the rows of the states a workload spends
+// its time in sit next to each other in the scan table and share cache lines.
+// The start state stays 0 and the rest follow, most visited first. Each input
+// runs from the start until it ends or the DFA dies; lengths may be NULL for
+// NUL-terminated inputs, as for matchDFABatch. The language, pattern lists and
+// state count are unchanged, and dfa itself is not. minimizeDFA numbers states
+// in its own order, so minimize before renumbering, not after.
+DFA *renumberDFAByProfile(DFA *dfa, const char **inputs, const size_t *lengths, int count)
+{
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+    int n = dfa->numStates, numClasses = dfa->numClasses;
+
+    long *visits = checkedCalloc(n + 1, sizeof(long));
+    for (int i = 0; i < count; i++)
+    {
+        const unsigned char *p = (const unsigned char *)inputs[i];
+        const unsigned char *end = p + (lengths != NULL ? lengths[i] : strlen(inputs[i]));
+        int state = 0;
+        visits[state]++;
+        while (p < end && state != n)
+        {
+            state = scanEntryDFA(dfa, (size_t)state * numClasses + dfa->byteClass[*p++]);
+            visits[state]++;
+        }
+    }
+
+    // order[i] is the old id of new state i, and newId the reverse
+    int *order = checkedRealloc(NULL, sizeof(int) * n);
+    int *newId = checkedRealloc(NULL, sizeof(int) * n);
+    for (int s = 0; s < n; s++)
+    {
+        order[s] = s;
+    }
+    visitCounts = visits;
+    qsort(order + 1, n - 1, sizeof(int), compareVisits);
+    for (int i = 0; i < n; i++)
+    {
+        newId[order[i]] = i;
+    }
+
+    DFA *renumbered = createDFA(n, 0, NULL);
+    if (dfa->patternStart != NULL)
+    {
+        renumbered->numPatterns = dfa->numPatterns;
+        renumbered->patternStart = checkedCalloc(n + 1, sizeof(int));
+        renumbered->patternIds = checkedRealloc(NULL, sizeof(int) * dfa->patternStart[n]);
+        for (int i = 0; i < n; i++)
+        {
+            const int *ids;
+            int idCount = patternsDFA(dfa, order[i], &ids);
+            renumbered->patternStart[i + 1] = renumbered->patternStart[i] + idCount;
+            memcpy(renumbered->patternIds + renumbered->patternStart[i], ids, sizeof(int) * idCount);
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        int s = order[i];
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            int t = scanEntryDFA(dfa, (size_t)s * numClasses + dfa->byteClass[x]);
+            if (t != n)
+                addTransitionDFA(renumbered, i, x, newId[t]);
+        }
+        if (dfa->accepting[s])
+            addFinalStateDFA(renumbered, i);
+    }
+    finalizeDFA(renumbered);
+
+    free(visits);
+    free(order);
+    free(newId);
+    return renumbered;
+}
+
+// Builds one DFA that runs all of the given DFAs at once (product
+// construction). Each state is a tuple of component states, and only tuples
+// reachable from the start are built; a tuple in which every component is dead
+// becomes the dead state. Pattern id i stands for dfas[i]: the pattern list of
+// a state holds the components that accept there, and the state is final if
+// any of them does. One scan then tells which of the DFAs accept the input.
+DFA *unionDFAs(DFA **dfas, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (dfas[i]->scanTable == NULL)
+            finalizeDFA(dfas[i]);
+    }
+
+    // Joint byte classes: two bytes share a class if they share one in every
+    // component
+    int representative[NUM_BYTES];
+    unsigned char jointClass[NUM_BYTES];
+    int numClasses = 0;
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        int c = 0;
+        while (c < numClasses)
+        {
+            int i = 0;
+            while (i < count && dfas[i]->byteClass[x] == dfas[i]->byteClass[representative[c]])
+                i++;
+            if (i == count)
+                break;
+            c++;
+        }
+        if (c == numClasses)
+            representative[numClasses++] = x;
+        jointClass[x] = c;
+    }
+
+    SetTable *tuples = createSetTable(count);
+    uint64_t *current = checkedRealloc(NULL, sizeof(uint64_t) * count);
+    uint64_t *next = checkedRealloc(NULL, sizeof(uint64_t) * count);
+    int *classTarget = checkedRealloc(NULL, sizeof(int) * numClasses);
+
+    DFA *dfa = createDFA(1, 0, NULL);
+
+    memset(current, 0, sizeof(uint64_t) * count);
+    findOrAddSet(tuples, current);
+
+    for (int processing = 0; processing < tuples->count; processing++)
+    {
+        memcpy(current, setTableKey(tuples, processing), sizeof(uint64_t) * count);
+
+        for (int c = 0; c < numClasses; c++)
+        {
+            bool alive = false;
+            for (int i = 0; i < count; i++)
+            {
+                DFA *component = dfas[i];
+                next[i] = scanEntryDFA(component, current[i] * component->numClasses + component->byteClass[representative[c]]);
+                alive |= next[i] != (uint64_t)component->numStates;
+            }
+            classTarget[c] = alive ? findOrAddSet(tuples, next) : -1;
+        }
+
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            if (classTarget[jointClass[x]] != -1)
+                addTransitionDFA(dfa, processing, x, classTarget[jointClass[x]]);
+        }
+    }
+
+    // Count, then list, the accepting components of every tuple
+    dfa->numStates = tuples->count;
+    dfa->numPatterns = count;
+    dfa->patternStart = checkedCalloc(dfa->numStates + 1, sizeof(int));
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int s = 0; s < dfa->numStates; s++)
+        {
+            const uint64_t *tuple = setTableKey(tuples, s);
+            int n = pass == 0 ? 0 : dfa->patternStart[s];
+            for (int i = 0; i < count; i++)
+            {
+                if (dfas[i]->accepting[tuple[i]])
+                {
+                    if (pass == 1)
+                        dfa->patternIds[n] = i;
+                    n++;
+                }
+            }
+            if (pass == 0)
+            {
+                dfa->patternStart[s + 1] = dfa->patternStart[s] + n;
+                if (n > 0)
+                    addFinalStateDFA(dfa, s);
+            }
+        }
+        if (pass == 0)
+            dfa->patternIds = checkedRealloc(NULL, sizeof(int) * dfa->patternStart[dfa->numStates]);
+    }
+
+    freeSetTable(tuples);
+    free(current);
+    free(next);
+    free(classTarget);
+    return dfa;
+}
+
+// Runs a multi-pattern DFA over input, sets ids to the patterns that accept
+// it and returns how many there are
+int matchPatternsDFA(DFA *dfa, const char *input, const int **ids)
+{
+    int state = stepDFA(dfa, 0, input, strlen(input));
+    return patternsDFA(dfa, state, ids);
+}
+
+// Marks in reaches, for every state of dfa and its dead state, whether some
+// input leads from it to a state whose acceptance is accepting. Works back
+// from those states along the reversed transitions of the scan table.
+void reachesAcceptanceDFA(DFA *dfa, bool accepting, bool *reaches)
+{
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+    int n = dfa->numStates + 1, numClasses = dfa->numClasses;
+
+    // Reversed edges as compressed rows: the states with an edge into t are
+    // sources[first[t]] up to sources[first[t + 1]]
+    int *first = checkedCalloc(n + 1, sizeof(int));
+    int *sources = checkedRealloc(NULL, sizeof(int) * n * numClasses);
+    for (size_t i = 0; i < (size_t)n * numClasses; i++)
+    {
+        first[scanEntryDFA(dfa, i) + 1]++;
+    }
+    for (int t = 0; t < n; t++)
+    {
+        first[t + 1] += first[t];
+    }
+    int *fill = checkedRealloc(NULL, sizeof(int) * n);
+    memcpy(fill, first, sizeof(int) * n);
+    for (size_t i = 0; i < (size_t)n * numClasses; i++)
+    {
+        sources[fill[scanEntryDFA(dfa, i)]++] = i / numClasses;
+    }
+
+    int *queue = checkedRealloc(NULL, sizeof(int) * n);
+    int queued = 0;
+    for (int s = 0; s < n; s++)
+    {
+        reaches[s] = dfa->accepting[s] == accepting;
+        if (reaches[s])
+            queue[queued++] = s;
+    }
+    for (int i = 0; i < queued; i++)
+    {
+        int t = queue[i];
+        for (int j = first[t]; j < first[t + 1]; j++)
+        {
+            if (!reaches[sources[j]])
+            {
+                reaches[sources[j]] = true;
+                queue[queued++] = sources[j];
+            }
+        }
+    }
+
+    free(first);
+    free(sources);
+    free(fill);
+    free(queue);
+}
+
+// How productDFA combines the languages of its two DFAs
+typedef enum
+{
+    PRODUCT_INTERSECTION, // accepted by both
+    PRODUCT_UNION,        // accepted by either
+    PRODUCT_DIFFERENCE    // accepted by the first but not the second
+} ProductOperation;
+
+bool combineProduct(ProductOperation operation, bool a, bool b)
+{
+    if (operation == PRODUCT_INTERSECTION)
+        return a && b;
+    if (operation == PRODUCT_UNION)
+        return a || b;
+    return a && !b;
+}
+
+// Builds a DFA for the intersection, union or difference of the languages of
+// a and b (product construction). Each state is a pair of states of a and b,
+// dead states included. Only pairs reachable from (0, 0) are built, and a
+// pair from which the result can never accept, such as one whose first state
+// is dead in an intersection, becomes the dead state at once instead of being
+// explored. Compound rules then cost one scan instead of one per DFA. The
+// result is not minimal; see minimizeDFA.
+DFA *productDFA(DFA *a, DFA *b, ProductOperation operation)
+{
+    if (a->scanTable == NULL)
+        finalizeDFA(a);
+    if (b->scanTable == NULL)
+        finalizeDFA(b);
+    int deadA = a->numStates, deadB = b->numStates;
+
+    // A pair can still lead to acceptance only if its states can still lead
+    // to what the operation needs of them: acceptance, or for the second DFA
+    // of a difference, rejection. A union needs this of either state, the
+    // others of both.
+    bool *liveA = checkedRealloc(NULL, deadA + 1);
+    bool *liveB = checkedRealloc(NULL, deadB + 1);
+    reachesAcceptanceDFA(a, true, liveA);
+    reachesAcceptanceDFA(b, operation != PRODUCT_DIFFERENCE, liveB);
+
+    // Joint byte classes: two bytes share a class if they share one in both
+    int representative[NUM_BYTES];
+    unsigned char jointClass[NUM_BYTES];
+    int numClasses = 0;
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        int c = 0;
+        while (c < numClasses && (a->byteClass[x] != a->byteClass[representative[c]] ||
+                                  b->byteClass[x] != b->byteClass[representative[c]]))
+            c++;
+        if (c == numClasses)
+            representative[numClasses++] = x;
+        jointClass[x] = c;
+    }
+
+    // A pair is one key word, the state of a in the high half
+    SetTable *pairs = createSetTable(1);
+    int *classTarget = checkedRealloc(NULL, sizeof(int) * numClasses);
+    DFA *dfa = createDFA(1, 0, NULL);
+
+    uint64_t pair = 0;
+    findOrAddSet(pairs, &pair);
+
+    for (int processing = 0; processing < pairs->count; processing++)
+    {
+        pair = *setTableKey(pairs, processing);
+        int s = pair >> 32, t = pair & 0xffffffff;
+        for (int c = 0; c < numClasses; c++)
+        {
+            int x = representative[c];
+            int nextS = scanEntryDFA(a, (size_t)s * a->numClasses + a->byteClass[x]);
+            int nextT = scanEntryDFA(b, (size_t)t * b->numClasses + b->byteClass[x]);
+            classTarget[c] = -1;
+            if (operation == PRODUCT_UNION ? liveA[nextS] || liveB[nextT] : liveA[nextS] && liveB[nextT])
+            {
+                uint64_t next = (uint64_t)nextS << 32 | (uint32_t)nextT;
+                classTarget[c] = findOrAddSet(pairs, &next);
+            }
+        }
+
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            if (classTarget[jointClass[x]] != -1)
+                addTransitionDFA(dfa, processing, x, classTarget[jointClass[x]]);
+        }
+    }
+
+    dfa->numStates = pairs->count;
+    for (int state = 0; state < pairs->count; state++)
+    {
+        pair = *setTableKey(pairs, state);
+        if (combineProduct(operation, a->accepting[pair >> 32], b->accepting[pair & 0xffffffff]))
+            addFinalStateDFA(dfa, state);
+    }
+
+    free(liveA);
+    free(liveB);
+    freeSetTable(pairs);
+    free(classTarget);
+    return dfa;
+}
+
+// Builds a DFA that accepts exactly the inputs dfa rejects, as the difference
+// between a one-state DFA that accepts everything and dfa
+DFA *complementDFA(DFA *dfa)
+{
+    int finalStates[] = {0};
+    DFA *everything = createDFA(1, 1, finalStates);
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        addTransitionDFA(everything, 0, x, 0);
+    }
+    DFA *complement = productDFA(everything, dfa, PRODUCT_DIFFERENCE);
+    freeDFA(everything);
+    return complement;
+}
+
+// Builds an Aho-Corasick automaton for a set of literal strings as a DFA. The
+// states are the nodes of the keyword trie. The failure link of a node is the
+// longest proper suffix that is also a node, and every missing transition is
+// taken from the failure link, so the DFA is complete and never dies. Pattern
+// id i stands for patterns[i], and a state accepts the patterns that end at
+// the current position: matchDFA tells whether the input ends with a keyword,
+// and scanMatchesDFA reports every occurrence in one pass.
+DFA *AhoCorasickDFA(const char **patterns, int count)
+{
+    DFA *dfa = createDFA(1, 0, NULL);
+
+    // Keyword trie
+    int *endState = checkedRealloc(NULL, sizeof(int) * count);
+    for (int p = 0; p < count; p++)
+    {
+        int s = 0;
+        for (const unsigned char *c = (const unsigned char *)patterns[p]; *c; c++)
+        {
+            int t = transitionDFA(dfa, s, *c);
+            if (t == -1)
+            {
+                t = dfa->numStates;
+                addTransitionDFA(dfa, s, *c, t);
+            }
+            s = t;
+        }
+        endState[p] = s;
+    }
+
+    // Breadth-first over the trie, so the failure link of a node and all of
+    // its transitions are known before the node is reached
+    int n = dfa->numStates;
+    int *fail = checkedRealloc(NULL, sizeof(int) * n);
+    int *order = checkedRealloc(NULL, sizeof(int) * n);
+    int queued = 0;
+    fail[0] = 0;
+    order[queued++] = 0;
+    for (int i = 0; i < queued; i++)
+    {
+        int s = order[i];
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            int t = transitionDFA(dfa, s, x);
+            int fallback = s == 0 ? 0 : transitionDFA(dfa, fail[s], x);
+            if (t == -1)
+            {
+                addTransitionDFA(dfa, s, x, fallback);
+            }
+            else
+            {
+                fail[t] = fallback;
+                order[queued++] = t;
+            }
+        }
+    }
+
+    // Patterns ending exactly at each node, as compressed rows in id order
+    int *directStart = checkedCalloc(n + 1, sizeof(int));
+    int *direct = checkedRealloc(NULL, sizeof(int) * count);
+    for (int p = 0; p < count; p++)
+    {
+        directStart[endState[p] + 1]++;
+    }
+    for (int s = 0; s < n; s++)
+    {
+        directStart[s + 1] += directStart[s];
+    }
+    int *fill = checkedRealloc(NULL, sizeof(int) * n);
+    memcpy(fill, directStart, sizeof(int) * n);
+    for (int p = 0; p < count; p++)
+    {
+        direct[fill[endState[p]]++] = p;
+    }
+
+    // A node accepts its own patterns and those of its failure link
+    dfa->numPatterns = count;
+    dfa->patternStart = checkedCalloc(n + 1, sizeof(int));
+    int *size = fill;
+    for (int i = 0; i < n; i++)
+    {
+        int s = order[i];
+        size[s] = directStart[s + 1] - directStart[s] + (s == 0 ? 0 : size[fail[s]]);
+    }
+    for (int s = 0; s < n; s++)
+    {
+        dfa->patternStart[s + 1] = dfa->patternStart[s] + size[s];
+        if (size[s] > 0)
+            addFinalStateDFA(dfa, s);
+    }
+    dfa->patternIds = checkedRealloc(NULL, sizeof(int) * dfa->patternStart[n]);
+    for (int i = 0; i < n; i++)
+    {
+        // Merge the two sorted lists
+        int s = order[i];
+        int *out = dfa->patternIds + dfa->patternStart[s];
+        const int *a = direct + directStart[s], *aEnd = direct + directStart[s + 1];
+        const int *b = NULL, *bEnd = NULL;
+        if (s != 0)
+        {
+            b = dfa->patternIds + dfa->patternStart[fail[s]];
+            bEnd = dfa->patternIds + dfa->patternStart[fail[s] + 1];
+        }
+        while (a < aEnd || b < bEnd)
+        {
+            if (b == bEnd || (a < aEnd && *a < *b))
+                *out++ = *a++;
+            else
+                *out++ = *b++;
+        }
+    }
+
+    free(endState);
+    free(fail);
+    free(order);
+    free(directStart);
+    free(direct);
+    free(fill);
+    return dfa;
+}
+
+typedef void (*MatchCallback)(size_t end, int state, void *context);
+
+// Runs the DFA over len bytes of buf and calls callback with the offset just
+// past the last byte read each time the DFA is in a final state, including
+// before the first byte. Stops early if the DFA dies. Returns the number of
+// calls. With an Aho-Corasick DFA this reports every keyword occurrence, and
+// patternsDFA(dfa, state, ...) tells which keywords end there.
+size_t scanMatchesDFA(DFA *dfa, const char *buf, size_t len, MatchCallback callback, void *context)
+{
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+
+    const unsigned char *p = (const unsigned char *)buf;
+    const unsigned char *byteClass = dfa->byteClass;
+    const bool *accepting = dfa->accepting;
+    int numClasses = dfa->numClasses;
+    int dead = dfa->numStates;
+    size_t matches = 0;
+    int state = 0;
+
+#define SCAN_MATCHES_LOOP(type)                                             \
+    {                                                                       \
+        const type *table = dfa->scanTable;                                 \
+        for (size_t i = 0;; i++)                                            \
+        {                                                                   \
+            if (accepting[state])                                           \
+            {                                                               \
+                callback(i, state, context);                                \
+                matches++;                                                  \
+            }                                                               \
+            if (i == len)                                                   \
+                break;                                                      \
+            state = table[state * numClasses + byteClass[p[i]]];            \
+            if (state == dead)                                              \
+                break;                                                      \
+        }                                                                   \
+    }
+
+    if (dfa->stateWidth == sizeof(uint8_t))
+        SCAN_MATCHES_LOOP(uint8_t)
+    else if (dfa->stateWidth == sizeof(uint16_t))
+        SCAN_MATCHES_LOOP(uint16_t)
+    else
+        SCAN_MATCHES_LOOP(int)
+
+    return matches;
+}
+
+// Builds the minimal DFA for the reversed language: it accepts the reverse of
+// every input dfa accepts. Runs of it backwards from the end of a match find
+// where the match starts. Returns NULL if the reversed DFA would take more than
+// budget bytes to build.
+DFA *reverseDFA(DFA *dfa, size_t budget)
+{
+    // NFA state 0 is a new start with epsilon moves to the old final states,
+    // and old state s becomes s + 1 with every edge turned around
+    int finalStates[] = {1};
+    NFA *nfa = createNFA(dfa->numStates + 1, 1, finalStates);
+    for (int s = 0; s < dfa->numStates; s++)
+    {
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            int t = transitionDFA(dfa, s, x);
+            if (t != -1)
+                addTransitionNFA(nfa, t + 1, x, s + 1);
+        }
+    }
+    for (int i = 0; i < dfa->numFinalStates; i++)
+    {
+        addEpsilonTransition(nfa, 0, dfa->finalStates[i] + 1);
+    }
+
+    DFA *reversed = NFA_to_DFALimited(nfa, budget);
+    freeNFA(nfa);
+    if (reversed == NULL)
+        return NULL;
+    DFA *minimal = minimizeDFA(reversed);
+    freeDFA(reversed);
+    return minimal;
+}
+
+// Where a search may stop: as soon as any match ends, once the leftmost start
+// is known and its first match has ended, or once the longest match from the
+// leftmost start is known.
+typedef enum
+{
+    SEARCH_EARLIEST,
+    SEARCH_LEFTMOST_FIRST,
+    SEARCH_LEFTMOST_LONGEST
+} SearchMode;
+
+// A match of the DFA's language at bytes [start, end) of the searched buffer
+typedef struct
+{
+    size_t start;
+    size_t end;
+} Match;
+
+#define SEARCH_ACCEPT 1  // a match ends here
+#define SEARCH_SETTLED 2 // the one run left has accepted, so it has the leftmost start
+#define SEARCH_MAX_STATES (1 << 16)
+
+enum
+{
+    NO_MATCH_YET,
+    LAST_PENDING,
+    LAST_ACCEPTED
+};
+
+// Unanchored search with a DFA that only accepts whole inputs. forward runs
+// over the text, and each of its states stands for the runs of the original
+// DFA from every start position so far, as a list of their distinct states in
+// order of start. Two runs in the same state behave alike from then on, so
+// only the earlier start is kept. A new run is started at every position
+// until some run accepts. Runs that started after the first accepting one
+// can only give matches further right, so they are dropped. The leftmost match
+// therefore belongs to the first run in the list that accepts, and the list
+// empties (the dead state) once nothing can extend it. reverse recovers the
+// start of a match from its end.
+typedef struct
+{
+    DFA *dfa;
+    DFA *forward;
+    unsigned char *flags; // SEARCH_ flags of each forward state, dead included
+    DFA *reverse;
+} SearchDFA;
+
+// Builds the search automata for dfa, which must outlive them. Returns NULL if
+// the forward search DFA would need more than SEARCH_MAX_STATES states, or if
+// either search DFA would need more than DFA_MEMORY_BUDGET bytes.
+SearchDFA *createSearchDFA(DFA *dfa)
+{
+    if (dfa->scanTable == NULL)
+        finalizeDFA(dfa);
+    int n = dfa->numStates;
+
+    // A key is the match flag, the run states in order and -1 padding. The
+    // flag is NO_MATCH_YET while new runs are still being started, and once a
+    // run has accepted, LAST_ACCEPTED if the last run in the list has accepted
+    // (runs after it were dropped) or LAST_PENDING if that run has since died
+    // or merged into an earlier one.
+    int keyInts = n + 2 + (n % 2);
+    int keyWords = keyInts / 2;
+    int maxStates = statesInBudget(DFA_MEMORY_BUDGET, bytesPerStateDFA(keyWords));
+    if (maxStates > SEARCH_MAX_STATES)
+        maxStates = SEARCH_MAX_STATES;
+    SetTable *states = createSetTable(keyWords);
+    int *current = checkedRealloc(NULL, sizeof(int) * keyInts);
+    int *next = checkedRealloc(NULL, sizeof(int) * keyInts);
+    uint64_t *key = checkedRealloc(NULL, sizeof(uint64_t) * keyWords);
+    int *seen = checkedRealloc(NULL, sizeof(int) * (n + 1));
+    int *classTarget = checkedRealloc(NULL, sizeof(int) * dfa->numClasses);
+    for (int s = 0; s <= n; s++)
+    {
+        seen[s] = -1;
+    }
+
+    SearchDFA *search = checkedCalloc(1, sizeof(SearchDFA));
+    search->dfa = dfa;
+    search->forward = createDFA(1, 0, NULL);
+
+    // The start is a single run from position 0, which may already accept
+    for (int i = 0; i < keyInts; i++)
+    {
+        next[i] = -1;
+    }
+    next[0] = dfa->accepting[0] ? LAST_ACCEPTED : NO_MATCH_YET;
+    next[1] = 0;
+    memcpy(key, next, sizeof(uint64_t) * keyWords);
+    findOrAddSet(states, key);
+
+    bool tooLarge = false;
+    for (int state = 0; state < states->count && !tooLarge; state++)
+    {
+        memcpy(current, setTableKey(states, state), sizeof(uint64_t) * keyWords);
+        for (int c = 0; c < dfa->numClasses; c++)
+        {
+            int stamp = state * dfa->numClasses + c;
+            int length = 0, flag = current[0];
+            bool lastSurvives = false;
+            for (int i = 0; i < keyInts; i++)
+            {
+                next[i] = -1;
+            }
+            for (int i = 1; i < keyInts && current[i] != -1; i++)
+            {
+                int t = scanEntryDFA(dfa, (size_t)current[i] * dfa->numClasses + c);
+                lastSurvives = false;
+                if (t != n && seen[t] != stamp)
+                {
+                    seen[t] = stamp;
+                    next[1 + length++] = t;
+                    lastSurvives = true;
+                }
+            }
+            if (flag == NO_MATCH_YET && seen[0] != stamp)
+                next[1 + length++] = 0;
+            else if (flag == LAST_ACCEPTED && !lastSurvives)
+                flag = LAST_PENDING;
+            for (int i = 0; i < length; i++)
+            {
+                if (dfa->accepting[next[1 + i]])
+                {
+                    // Later starts cannot be leftmost
+                    for (int j = i + 1; j < length; j++)
+                    {
+                        next[1 + j] = -1;
+                    }
+                    length = i + 1;
+                    flag = LAST_ACCEPTED;
+                    break;
+                }
+            }
+            next[0] = flag;
+
+            classTarget[c] = -1;
+            if (length > 0)
+            {
+                memcpy(key, next, sizeof(uint64_t) * keyWords);
+                classTarget[c] = findOrAddSet(states, key);
+            }
+        }
+        for (int x = 0; x < NUM_BYTES; x++)
+        {
+            if (classTarget[dfa->byteClass[x]] != -1)
+                addTransitionDFA(search->forward, state, x, classTarget[dfa->byteClass[x]]);
+        }
+        tooLarge = states->count > maxStates;
+    }
+
+    if (!tooLarge)
+    {
+        search->reverse = reverseDFA(dfa, DFA_MEMORY_BUDGET);
+        tooLarge = search->reverse == NULL;
+    }
+    if (tooLarge)
+    {
+        freeDFA(search->forward);
+        free(search);
+        search = NULL;
+    }
+    else
+    {
+        finalizeDFA(search->reverse);
+        search->forward->numStates = states->count;
+        search->flags = checkedCalloc(states->count + 1, 1);
+        for (int state = 0; state < states->count; state++)
+        {
+            memcpy(current, setTableKey(states, state), sizeof(uint64_t) * keyWords);
+            int length = 0;
+            while (length + 1 < keyInts && current[1 + length] != -1)
+                length++;
+            if (current[0] != NO_MATCH_YET && dfa->accepting[current[length]])
+            {
+                search->flags[state] |= SEARCH_ACCEPT;
+                addFinalStateDFA(search->forward, state);
+            }
+            if (current[0] == LAST_ACCEPTED && length == 1)
+                search->flags[state] |= SEARCH_SETTLED;
+        }
+        finalizeDFA(search->forward);
+    }
+
+    freeSetTable(states);
+    free(current);
+    free(next);
+    free(key);
+    free(seen);
+    free(classTarget);
+    return search;
+}
+
+void freeSearchDFA(SearchDFA *search)
+{
+    freeDFA(search->forward);
+    freeDFA(search->reverse);
+    free(search->flags);
+    free(search);
+}
+
+// The forward scan of searchDFA, once per entry width. Records the offset of
+// every accepting position and stops at a state with a flag in stopMask, at
+// the dead state, or in a state it can never leave, which if accepting makes
+// the end of the buffer the last match end. Other non-accepting states skip
+// ahead to their next escape byte.
+#define SEARCH_LOOP(type)                                                             \
+    {                                                                                 \
+        const type *table = forward->scanTable;                                       \
+        while (p < end)                                                               \
+        {                                                                             \
+            int escapes = forward->escapeCount[state];                                \
+            if (escapes == 0)                                                         \
+            {                                                                         \
+                if (flags[state] & SEARCH_ACCEPT)                                     \
+                    lastEnd = len;                                                    \
+                break;                                                                \
+            }                                                                         \
+            if (escapes <= ACCEL_BYTES && flags[state] == 0)                          \
+            {                                                                         \
+                p = findAnyByte(p, end, forward->escapeBytes + state * ACCEL_BYTES,   \
+                                escapes);                                             \
+                if (p == end)                                                         \
+                    break;                                                            \
+            }                                                                         \
+            state = table[state * numClasses + byteClass[*p++]];                      \
+            if (state == dead)                                                        \
+                break;                                                                \
+            if (flags[state] & SEARCH_ACCEPT)                                         \
+            {                                                                         \
+                found = true;                                                         \
+                lastEnd = p - (const unsigned char *)buf;                             \
+            }                                                                         \
+            if (flags[state] & stopMask)                                              \
+                break;                                                                \
+        }                                                                             \
+    }
+
+// Searches len bytes of buf for a match of the DFA's language. Returns false
+// if there is none. Otherwise fills in match, according to mode, as one of:
+//   SEARCH_EARLIEST: the match that ends first, and the leftmost start of the
+//     matches ending there
+//   SEARCH_LEFTMOST_FIRST: the leftmost start, and the first match from there
+//   SEARCH_LEFTMOST_LONGEST: the leftmost start, and the longest match from there
+// The forward scan stops as soon as mode has its answer, and reverse then
+// walks back from the end to find the start. match may be NULL if only
+// whether there is a match matters, which SEARCH_EARLIEST finds soonest.
+bool searchDFA(SearchDFA *search, const char *buf, size_t len, SearchMode mode, Match *match)
+{
+    DFA *forward = search->forward;
+    const unsigned char *p = (const unsigned char *)buf, *end = p + len;
+    const unsigned char *byteClass = forward->byteClass;
+    const unsigned char *flags = search->flags;
+    int numClasses = forward->numClasses;
+    int dead = forward->numStates;
+    int stopMask = mode == SEARCH_EARLIEST ? SEARCH_ACCEPT : mode == SEARCH_LEFTMOST_FIRST ? SEARCH_SETTLED : 0;
+
+    int state = 0;
+    bool found = (flags[0] & SEARCH_ACCEPT) != 0;
+    size_t lastEnd = 0;
+    if (!(flags[0] & stopMask))
+    {
+        if (forward->stateWidth == sizeof(uint8_t))
+            SEARCH_LOOP(uint8_t)
+        else if (forward->stateWidth == sizeof(uint16_t))
+            SEARCH_LOOP(uint16_t)
+        else
+            SEARCH_LOOP(int)
+    }
+    if (!found || match == NULL)
+        return found;
+
+    // The furthest-back position the reverse DFA accepts at is the leftmost
+    // start of a match ending at lastEnd
+    DFA *reverse = search->reverse;
+    int back = 0;
+    size_t start = lastEnd;
+    for (size_t i = lastEnd; i > 0 && back != -1; i--)
+    {
+        back = transitionDFA(reverse, back, (unsigned char)buf[i - 1]);
+        if (back != -1 && reverse->accepting[back])
+            start = i - 1;
+    }
+    match->start = start;
+    match->end = lastEnd;
+
+    // The first match from the leftmost start may end before lastEnd
+    if (mode == SEARCH_LEFTMOST_FIRST)
+    {
+        DFA *dfa = search->dfa;
+        int s = 0;
+        size_t i = start;
+        while (!dfa->accepting[s])
+        {
+            s = transitionDFA(dfa, s, (unsigned char)buf[i++]);
+        }
+        match->end = i;
+    }
+    return true;
+}
+
+double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift32, so benchmark inputs are the same on every run
+uint32_t nextRandom(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+#define BENCH_STRINGS 20000
+#define BENCH_STRING_LENGTH 200
+#define BENCH_BUILD_REPEATS 100
+#define BENCH_LAZY_STATES 64
+#define BENCH_ALPHABET "xyz0123456789 ghmoaicl"
+
+typedef struct
+{
+    const char *name;
+    NFA *(*build)();
+} NamedNFA;
+
+NamedNFA builtinNFAs[] = {
+    {"gh", NFAStringsEndingInGH},
+    {"moo", NFAStringsContainingMoo},
+    {"special", NFASpecialString},
+};
+
+// A reproducible set of benchmark inputs: BENCH_STRINGS strings of at most
+// BENCH_STRING_LENGTH bytes, each in its own NUL-terminated slot of text
+typedef struct
+{
+    const char *name;
+    char *text;
+    const char **inputs;
+    size_t *lengths;
+    double totalBytes;
+} Corpus;
+
+Corpus createCorpus(const char *name)
+{
+    Corpus corpus = {name, NULL, NULL, NULL, 0};
+    corpus.text = checkedRealloc(NULL, (size_t)BENCH_STRINGS * (BENCH_STRING_LENGTH + 1));
+    corpus.inputs = checkedRealloc(NULL, sizeof(char *) * BENCH_STRINGS);
+    corpus.lengths = checkedRealloc(NULL, sizeof(size_t) * BENCH_STRINGS);
+    for (int i = 0; i < BENCH_STRINGS; i++)
+    {
+        corpus.inputs[i] = corpus.text + (size_t)i * (BENCH_STRING_LENGTH + 1);
+    }
+    return corpus;
+}
+
+// Call once every string has been written
+void finishCorpus(Corpus *corpus)
+{
+    corpus->totalBytes = 0;
+    for (int i = 0; i < BENCH_STRINGS; i++)
+    {
+        corpus->lengths[i] = strlen(corpus->inputs[i]);
+        corpus->totalBytes += corpus->lengths[i];
+    }
+}
+
+void freeCorpus(Corpus *corpus)
+{
+    free(corpus->text);
+    free(corpus->inputs);
+    free(corpus->lengths);
+}
+
+// Uniformly random strings over a fixed set of bytes
+Corpus randomCorpus(const char *name, const char *alphabet, int alphabetSize, uint32_t seed)
+{
+    Corpus corpus = createCorpus(name);
+    for (int i = 0; i < BENCH_STRINGS; i++)
+    {
+        char *str = (char *)corpus.inputs[i];
+        for (int j = 0; j < BENCH_STRING_LENGTH; j++)
+        {
+            str[j] = alphabet[nextRandom(&seed) % alphabetSize];
+        }
+        str[BENCH_STRING_LENGTH] = '\0';
+    }
+    finishCorpus(&corpus);
+    return corpus;
+}
+
+// Strings the DFA accepts: a random walk that never strays further from an
+// accepting state than the remaining length allows, finished along a
+// shortest path to one. Falls back to random text if nothing is accepted.
+Corpus denseCorpus(DFA *dfa, uint32_t seed)
+{
+    // Distance from each state to the nearest accepting state, by repeated
+    // relaxation, which is quick enough for the built-in automata
+    int n = dfa->numStates, unreachable = BENCH_STRING_LENGTH + 1;
+    int *distance = checkedRealloc(NULL, sizeof(int) * n);
+    for (int s = 0; s < n; s++)
+    {
+        distance[s] = isDFAFinalState(dfa, s) ? 0 : unreachable;
+    }
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (int s = 0; s < n; s++)
+        {
+            for (int x = 1; x < NUM_BYTES; x++)
+            {
+                int t = transitionDFA(dfa, s, x);
+                if (t != -1 && distance[t] + 1 < distance[s])
+                {
+                    distance[s] = distance[t] + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+    if (distance[0] > BENCH_STRING_LENGTH)
+    {
+        free(distance);
+        return randomCorpus("dense", BENCH_ALPHABET, sizeof(BENCH_ALPHABET) - 1, seed);
+    }
+
+    Corpus corpus = createCorpus("dense");
+    unsigned char choices[NUM_BYTES];
+    for (int i = 0; i < BENCH_STRINGS; i++)
+    {
+        char *str = (char *)corpus.inputs[i];
+        int state = 0, length = 0;
+        while (length < BENCH_STRING_LENGTH)
+        {
+            int numChoices = 0;
+            for (int x = 1; x < NUM_BYTES; x++)
+            {
+                int t = transitionDFA(dfa, state, x);
+                if (t != -1 && length + 1 + distance[t] <= BENCH_STRING_LENGTH)
+                    choices[numChoices++] = x;
+            }
+            if (numChoices == 0)
+                break;
+            int x = choices[nextRandom(&seed) % numChoices];
+            str[length++] = x;
+            state = transitionDFA(dfa, state, x);
+        }
+        str[length] = '\0';
+    }
+    finishCorpus(&corpus);
+    free(distance);
+    return corpus;
+}
+
+// Random strings over the bytes that move some state of the DFA somewhere
+// other than itself or the dead state. They keep the automaton changing state
+// and defeat the escape-byte skipping of scanDFA.
+Corpus adversarialCorpus(DFA *dfa, uint32_t seed)
+{
+    char active[NUM_BYTES];
+    int numActive = 0;
+    for (int x = 1; x < NUM_BYTES; x++)
+    {
+        bool moves = false;
+        for (int s = 0; s < dfa->numStates && !moves; s++)
+        {
+            int t = transitionDFA(dfa, s, x);
+            moves = t != -1 && t != s;
+        }
+        if (moves)
+            active[numActive++] = x;
+    }
+    if (numActive == 0)
+        return randomCorpus("adversarial", BENCH_ALPHABET, sizeof(BENCH_ALPHABET) - 1, seed);
+    return randomCorpus("adversarial", active, numActive, seed);
+}
+
+int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Matches one input with some automaton
+typedef bool (*MatchFunction)(void *automaton, const char *input);
+
+bool benchRunDFA(void *automaton, const char *input)
+{
+    return runDFA(automaton, input);
+}
+
+bool benchMatchDFA(void *automaton, const char *input)
+{
+    return matchDFA(automaton, input);
+}
+
+bool benchRunNFA(void *automaton, const char *input)
+{
+    return runNFA(automaton, input);
+}
+
+bool benchRunLazyDFA(void *automaton, const char *input)
+{
+    return runLazyDFA(automaton, input);
+}
+
+// Times one engine on a corpus: throughput over a plain loop, then latency
+// percentiles from timing every call on its own. Output written by the engine
+// goes to /dev/null while it is timed. Returns the number of accepted inputs.
+int benchEngine(const char *automaton, const char *engine, MatchFunction match, void *context, Corpus *corpus)
+{
+    static double latency[BENCH_STRINGS];
+    int accepted = 0;
+
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+
+    double start = nowSeconds();
+    for (int i = 0; i < BENCH_STRINGS; i++)
+    {
+        accepted += match(context, corpus->inputs[i]);
+    }
+    double elapsed = nowSeconds() - start;
+    for (int i = 0; i < BENCH_STRINGS; i++)
+    {
+        double callStart = nowSeconds();
+        match(context, corpus->inputs[i]);
+        latency[i] = nowSeconds() - callStart;
+    }
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    close(devNull);
 
-        bool result = runNFA(nfa, input);
-        printf("Input '%s' is %s\n", input, result ? "accepted" : "rejected");
-        printf("\n");
+    qsort(latency, BENCH_STRINGS, sizeof(double), compareDoubles);
+    printf("%-8s %-12s %-10s %10.1f %9.0f %9.0f %9.0f %9d\n", automaton, corpus->name, engine,
+           corpus->totalBytes / elapsed / 1e6, latency[BENCH_STRINGS / 2] * 1e9,
+           latency[BENCH_STRINGS * 9 / 10] * 1e9, latency[BENCH_STRINGS * 99 / 100] * 1e9, accepted);
+    return accepted;
+}
+
+// matchDFABatch takes the whole corpus at once, so it has no per-call latency
+int benchBatch(const char *automaton, DFA *dfa, Corpus *corpus)
+{
+    bool *results = checkedRealloc(NULL, sizeof(bool) * BENCH_STRINGS);
+    double start = nowSeconds();
+    matchDFABatch(dfa, corpus->inputs, corpus->lengths, BENCH_STRINGS, results);
+    double elapsed = nowSeconds() - start;
+    int accepted = 0;
+    for (int i = 0; i < BENCH_STRINGS; i++)
+    {
+        accepted += results[i];
     }
-    printf("\n");
+    free(results);
+    printf("%-8s %-12s %-10s %10.1f %9s %9s %9s %9d\n", automaton, corpus->name, "batch",
+           corpus->totalBytes / elapsed / 1e6, "-", "-", "-", accepted);
+    return accepted;
 }
 
-NFA *NFAStringsEndingInGH()
+// Builds the three corpora for an automaton whose language dfa decides
+void createCorpora(DFA *dfa, Corpus *corpora)
 {
-    int finalStates[] = {2};
-    NFA *nfa = createNFA(3, 1, finalStates);
+    corpora[0] = randomCorpus("random", BENCH_ALPHABET, sizeof(BENCH_ALPHABET) - 1, 173);
+    corpora[1] = denseCorpus(dfa, 174);
+    corpora[2] = adversarialCorpus(dfa, 175);
+}
 
-    addTransitionNFA(nfa, 0, 'g', 1);
+void reportMismatch(const char *automaton, const char *corpus, int expected, int accepted)
+{
+    if (accepted != expected)
+        printf("%s on %s: engines disagree, %d accepted against %d\n", automaton, corpus, accepted, expected);
+}
 
-    addTransitionNFA(nfa, 1, 'h', 2);
+// ./automata --bench
+// Benchmarks every built-in automaton on three reproducible corpora: random
+// text, text the automaton accepts throughout, and random text over only the
+// bytes that change its state. Prints throughput and per-string latency for
+// each engine, then the time to build each automaton and convert, minimize
+// and prepare it for searching. The inputs are the same on every run, so the
+// output of two builds can be compared line by line.
+int benchMain()
+{
+    Corpus corpora[3];
+    printf("%-8s %-12s %-10s %10s %9s %9s %9s %9s\n", "name", "corpus", "engine", "MB/s",
+           "p50 ns", "p90 ns", "p99 ns", "accepted");
 
-    for (int c = 0; c < MAX_ALPHABET; c++)
+    for (size_t d = 0; d < sizeof(builtinDFAs) / sizeof(builtinDFAs[0]); d++)
     {
-        if (c != 'g')
+        const char *name = builtinDFAs[d].name;
+        DFA *dfa = builtinDFAs[d].build();
+        createCorpora(dfa, corpora);
+        for (int c = 0; c < 3; c++)
         {
-            addTransitionNFA(nfa, 0, c, 0);
+            int expected = benchEngine(name, "runDFA", benchRunDFA, dfa, &corpora[c]);
+            reportMismatch(name, corpora[c].name, expected, benchEngine(name, "matchDFA", benchMatchDFA, dfa, &corpora[c]));
+            reportMismatch(name, corpora[c].name, expected, benchBatch(name, dfa, &corpora[c]));
+            freeCorpus(&corpora[c]);
         }
-        if (c != 'h')
+        freeDFA(dfa);
+    }
+
+    for (size_t i = 0; i < sizeof(builtinNFAs) / sizeof(builtinNFAs[0]); i++)
+    {
+        const char *name = builtinNFAs[i].name;
+        NFA *nfa = builtinNFAs[i].build();
+        DFA *converted = NFA_to_DFA(nfa);
+        DFA *dfa = minimizeDFA(converted);
+        LazyDFA *lazy = createLazyDFA(nfa, BENCH_LAZY_STATES);
+        createCorpora(dfa, corpora);
+        for (int c = 0; c < 3; c++)
         {
-            addTransitionNFA(nfa, 1, c, 0); // Changed from 1 to 0
+            int expected = benchEngine(name, "runNFA", benchRunNFA, nfa, &corpora[c]);
+            reportMismatch(name, corpora[c].name, expected, benchEngine(name, "lazyDFA", benchRunLazyDFA, lazy, &corpora[c]));
+            reportMismatch(name, corpora[c].name, expected, benchEngine(name, "matchDFA", benchMatchDFA, dfa, &corpora[c]));
+            reportMismatch(name, corpora[c].name, expected, benchBatch(name, dfa, &corpora[c]));
+            freeCorpus(&corpora[c]);
         }
-        if (c != 'g')
+        freeLazyDFA(lazy);
+        freeDFA(converted);
+        freeDFA(dfa);
+        freeNFA(nfa);
+    }
+
+    // Construction, averaged over BENCH_BUILD_REPEATS builds
+    printf("\n%-8s %9s %7s %11s %7s %11s %7s %11s\n", "name", "build us", "states", "convert us",
+           "states", "minimize us", "states", "search us");
+    size_t numAutomata = sizeof(builtinDFAs) / sizeof(builtinDFAs[0]) + sizeof(builtinNFAs) / sizeof(builtinNFAs[0]);
+    for (size_t a = 0; a < numAutomata; a++)
+    {
+        bool isNFA = a >= sizeof(builtinDFAs) / sizeof(builtinDFAs[0]);
+        NamedNFA *named = isNFA ? &builtinNFAs[a - sizeof(builtinDFAs) / sizeof(builtinDFAs[0])] : NULL;
+        double buildTime = 0, convertTime = 0, minimizeTime = 0, searchTime = 0;
+        int builtStates = 0, convertedStates = 0, minimalStates = 0;
+        for (int r = 0; r < BENCH_BUILD_REPEATS; r++)
         {
-            addTransitionNFA(nfa, 2, c, 0); // Changed from 2 to 0
+            double start = nowSeconds();
+            NFA *nfa = NULL;
+            DFA *dfa;
+            if (isNFA)
+            {
+                nfa = named->build();
+                finalizeNFA(nfa);
+                buildTime += nowSeconds() - start;
+                builtStates = nfa->numStates;
+                start = nowSeconds();
+                dfa = NFA_to_DFA(nfa);
+                convertTime += nowSeconds() - start;
+                convertedStates = dfa->numStates;
+            }
+            else
+            {
+                dfa = builtinDFAs[a].build();
+                finalizeDFA(dfa);
+                buildTime += nowSeconds() - start;
+                builtStates = dfa->numStates;
+            }
+
+            start = nowSeconds();
+            DFA *minimal = minimizeDFA(dfa);
+            minimizeTime += nowSeconds() - start;
+            minimalStates = minimal->numStates;
+
+            // A search DFA that is too large fails the same way every time
+            if (searchTime >= 0)
+            {
+                start = nowSeconds();
+                SearchDFA *search = createSearchDFA(minimal);
+                searchTime += nowSeconds() - start;
+                if (search != NULL)
+                    freeSearchDFA(search);
+                else
+                    searchTime = -1;
+            }
+
+            freeDFA(minimal);
+            freeDFA(dfa);
+            if (nfa != NULL)
+                freeNFA(nfa);
         }
-        else
+
+        double scale = 1e6 / BENCH_BUILD_REPEATS;
+        char convert[16] = "-", converted[16] = "-", search[16] = "-";
+        if (isNFA)
         {
-            addTransitionNFA(nfa, 2, 'g', 1);
+            snprintf(convert, sizeof(convert), "%.1f", convertTime * scale);
+            snprintf(converted, sizeof(converted), "%d", convertedStates);
         }
+        if (searchTime >= 0)
+            snprintf(search, sizeof(search), "%.1f", searchTime * scale);
+        printf("%-8s %9.1f %7d %11s %7s %11.1f %7d %11s\n", isNFA ? named->name : builtinDFAs[a].name,
+               buildTime * scale, builtStates, convert, converted, minimizeTime * scale, minimalStates, search);
     }
-
-    return nfa;
+    return 0;
 }
 
-NFA *NFAStringsContainingMoo()
+// Builds the minimal DFA for a regex. Returns NULL and says why on stderr if
+// the regex is malformed or its DFA would take more than DFA_MEMORY_BUDGET
+// bytes to build.
+DFA *regexToDFA(const char *pattern)
 {
-    int finalStates[] = {3};
-    NFA *nfa = createNFA(4, 1, finalStates);
-
-    // State 0: Initial state
-    // State 1: Seen 'm'
-    // State 2: Seen 'mo'
-    // State 3: Seen 'moo' (accepting state)
-
-    for (int c = 0; c < 128; c++)
+    NFA *nfa = compileRegex(pattern);
+    if (nfa == NULL)
+        return NULL;
+    DFA *dfa = NFA_to_DFALimited(nfa, DFA_MEMORY_BUDGET);
+    freeNFA(nfa);
+    if (dfa == NULL)
     {
-        addTransitionNFA(nfa, 0, c, 0);
+        fprintf(stderr, "Regex '%s' needs more than %zu MB as a DFA\n", pattern, DFA_MEMORY_BUDGET >> 20);
+        return NULL;
     }
-    addTransitionNFA(nfa, 0, 'm', 1);
+    DFA *minimal = minimizeDFA(dfa);
+    freeDFA(dfa);
+    return minimal;
+}
 
-    for (int c = 0; c < 128; c++)
+// Finds the built-in DFA called name or, failing that, loads name as a file
+// written by --compile. Reports the problem and returns NULL if neither works.
+DFA *openDFA(const char *name)
+{
+    DFA *dfa = lookupDFA(name);
+    if (dfa == NULL && access(name, F_OK) == 0)
+        return loadDFA(name);
+    if (dfa == NULL)
+        fprintf(stderr, "Unknown automaton '%s'\n", name);
+    return dfa;
+}
+
+// Renumbers dfa by profiling it on the lines of the file at path. Returns
+// NULL if the file cannot be read.
+DFA *renumberDFAByFile(DFA *dfa, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) != 0)
     {
-        addTransitionNFA(nfa, 1, c, 0);
+        perror(path);
+        if (fd != -1)
+            close(fd);
+        return NULL;
     }
-    addTransitionNFA(nfa, 1, 'o', 2);
-
-    for (int c = 0; c < 128; c++)
+    size_t len = info.st_size;
+    char *data = len > 0 ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED)
     {
-        addTransitionNFA(nfa, 2, c, 0);
+        perror(path);
+        return NULL;
     }
-    addTransitionNFA(nfa, 2, 'o', 3);
 
-    for (int c = 0; c < 128; c++)
+    int count = 0, capacity = 0;
+    const char **inputs = NULL;
+    size_t *lengths = NULL;
+    for (const char *line = data, *end = data + len; line < end;)
     {
-        addTransitionNFA(nfa, 3, c, 3);
+        const char *newline = memchr(line, '\n', end - line);
+        if (newline == NULL)
+            newline = end;
+        if (count == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 1024;
+            inputs = checkedRealloc(inputs, sizeof(char *) * capacity);
+            lengths = checkedRealloc(lengths, sizeof(size_t) * capacity);
+        }
+        inputs[count] = line;
+        lengths[count++] = newline - line;
+        line = newline + 1;
     }
 
-    return nfa;
+    DFA *renumbered = renumberDFAByProfile(dfa, inputs, lengths, count);
+    if (data != NULL)
+        munmap(data, len);
+    free(inputs);
+    free(lengths);
+    return renumbered;
 }
 
-NFA *NFASpecialString()
-{                                          // >1 'a' or 'i' || >2 'y' || >3 'c' or 'l'
-    int finalStates[] = {2, 4, 7, 11, 15}; // Accept states for each condition
-    NFA *nfa = createNFA(16, 5, finalStates);
-
-    // States: 0 (start), 1-2 (a), 3-4 (i), 5-7 (y), 8-11 (c), 12-15 (l)
-
-    // Transitions for counting 'a'
-    addTransitionNFA(nfa, 0, 'a', 1);
-    addTransitionNFA(nfa, 1, 'a', 2);
-
-    // Transitions for counting 'i'
-    addTransitionNFA(nfa, 0, 'i', 3);
-    addTransitionNFA(nfa, 3, 'i', 4);
+// ./automata --compile NAME FILE [SAMPLE]
+// ./automata --compile -e REGEX FILE [SAMPLE]
+// Builds a built-in DFA, or the minimal DFA for a regex, and saves it to FILE,
+// which --stream then accepts in place of a name. Given a SAMPLE file, the
+// states are first renumbered so that those its lines visit most come first.
+int compileMain(int argc, char **argv)
+{
+    bool regex = argc > 2 && strcmp(argv[2], "-e") == 0;
+    int fileArg = regex ? 4 : 3;
+    if (argc != fileArg + 1 && argc != fileArg + 2)
+    {
+        fprintf(stderr, "usage: %s --compile NAME FILE [SAMPLE]\n       %s --compile -e REGEX FILE [SAMPLE]\n",
+                argv[0], argv[0]);
+        return 2;
+    }
 
-    // Transitions for counting 'y'
-    addTransitionNFA(nfa, 0, 'y', 5);
-    addTransitionNFA(nfa, 5, 'y', 6);
-    addTransitionNFA(nfa, 6, 'y', 7);
+    DFA *dfa = regex ? regexToDFA(argv[3]) : openDFA(argv[2]);
+    if (dfa == NULL)
+        return 2;
+    if (argc == fileArg + 2)
+    {
+        DFA *renumbered = renumberDFAByFile(dfa, argv[fileArg + 1]);
+        freeDFA(dfa);
+        if (renumbered == NULL)
+            return 2;
+        dfa = renumbered;
+    }
+    const char *path = argv[fileArg];
+    bool saved = saveDFA(dfa, path);
+    if (saved)
+        printf("Wrote a DFA with %d states to %s\n", dfa->numStates, path);
+    freeDFA(dfa);
+    return saved ? 0 : 2;
+}
 
-    // Transitions for counting 'c'
-    addTransitionNFA(nfa, 0, 'c', 8);
-    addTransitionNFA(nfa, 8, 'c', 9);
-    addTransitionNFA(nfa, 9, 'c', 10);
-    addTransitionNFA(nfa, 10, 'c', 11);
+// ./automata --stream NAME [FILE]
+// Runs the named built-in or compiled DFA over the whole of FILE (or stdin)
+// and reports whether it is accepted. The exit status is 0 if accepted and 1
+// otherwise.
+int streamMain(int argc, char **argv)
+{
+    if (argc < 3 || argc > 4)
+    {
+        fprintf(stderr, "usage: %s --stream NAME [FILE]\n", argv[0]);
+        return 2;
+    }
 
-    // Transitions for counting 'l'
-    addTransitionNFA(nfa, 0, 'l', 12);
-    addTransitionNFA(nfa, 12, 'l', 13);
-    addTransitionNFA(nfa, 13, 'l', 14);
-    addTransitionNFA(nfa, 14, 'l', 15);
+    DFA *dfa = openDFA(argv[2]);
+    if (dfa == NULL)
+        return 2;
 
-    // Self-loops for all states
-    for (int s = 0; s < 16; s++)
+    FILE *fp = stdin;
+    if (argc == 4 && strcmp(argv[3], "-") != 0)
     {
-        for (int c = 0; c < 128; c++)
+        fp = fopen(argv[3], "rb");
+        if (fp == NULL)
         {
-            addTransitionNFA(nfa, s, c, s);
+            perror(argv[3]);
+            freeDFA(dfa);
+            return 2;
         }
     }
 
-    return nfa;
+    bool result = runDFAFile(dfa, fp);
+    printf("Input is %s\n", result ? "accepted" : "rejected");
+
+    if (fp != stdin)
+        fclose(fp);
+    freeDFA(dfa);
+    return result ? 0 : 1;
 }
 
+#define GREP_BUFFER_SIZE (1 << 20)
+
+// Output collected in memory and written GREP_BUFFER_SIZE bytes at a time
 typedef struct
 {
-    int states[MAX_STATES];
-    int count;
-} StateSet;
+    char *data;
+    size_t used;
+} OutputBuffer;
 
-bool contains(StateSet *set, int state)
+void flushOutput(OutputBuffer *out)
 {
-    for (int i = 0; i < set->count; i++)
-    {
-        if (set->states[i] == state)
-            return true;
-    }
-    return false;
+    fwrite(out->data, 1, out->used, stdout);
+    out->used = 0;
 }
 
-bool equalSets(StateSet *set1, StateSet *set2)
+void writeOutput(OutputBuffer *out, const char *data, size_t len)
 {
-    if (set1->count != set2->count)
-        return false;
-    for (int i = 0; i < set1->count; i++)
+    if (out->used + len > GREP_BUFFER_SIZE)
+        flushOutput(out);
+    if (len > GREP_BUFFER_SIZE)
     {
-        if (!contains(set2, set1->states[i]))
-            return false;
+        fwrite(data, 1, len, stdout);
+        return;
     }
-    return true;
+    memcpy(out->data + out->used, data, len);
+    out->used += len;
 }
 
-int findDFAState(StateSet *workList, int workListSize, StateSet *set)
+typedef struct
 {
-    for (int i = 0; i < workListSize; i++)
-    {
-        if (equalSets(&workList[i], set))
-            return i;
-    }
-    return -1;
-}
+    bool count;      // -c: print only the number of selected lines
+    bool invert;     // -v: select the lines that do not match
+    bool wholeLine;  // -x: the whole line must be accepted
+    bool lineNumber; // -n: prefix lines with their number
+    bool onlyMatch;  // -o: print each leftmost-longest match on its own line
+} GrepOptions;
 
-bool isNFAFinalState(NFA *nfa, int state)
+#define GREP_LAZY_STATES 4096
+
+// Builds an NFA for the reverse of nfa's language: state 0 is a new start with
+// epsilon moves to the old final states, and old state s becomes s + 1 with
+// every edge turned around
+NFA *reverseNFA(NFA *nfa)
 {
+    int finalStates[] = {1};
+    NFA *reversed = createNFA(nfa->numStates + 1, 1, finalStates);
+    for (int i = 0; i < nfa->numEdges; i++)
+    {
+        addTransitionNFA(reversed, nfa->edges[i].to + 1, nfa->edges[i].input, nfa->edges[i].from + 1);
+    }
+    for (int i = 0; i < nfa->numEpsilonEdges; i++)
+    {
+        addEpsilonTransition(reversed, nfa->epsilonEdges[i].to + 1, nfa->epsilonEdges[i].from + 1);
+    }
     for (int i = 0; i < nfa->numFinalStates; i++)
     {
-        if (nfa->finalStates[i] == state)
-            return true;
+        addEpsilonTransition(reversed, 0, nfa->finalStates[i] + 1);
     }
-    return false;
+    return reversed;
 }
 
-void epsilonClosure(NFA *nfa, StateSet *set)
+// What grepLine matches lines with. A regex whose DFA or search DFA is over
+// DFA_MEMORY_BUDGET is matched with lazy DFAs over its NFA instead: whole
+// maps the regex itself, and contains the regex with every byte looping on
+// its start and final states, which accepts any line containing a match.
+// For -o, starts is the reversed regex with every byte looping on its new
+// start; run backwards over a line it accepts at exactly the offsets where a
+// match begins, which are kept in startsAt.
+typedef struct
+{
+    DFA *dfa;
+    SearchDFA *search;
+    NFA *nfa;
+    NFA *containsNFA;
+    NFA *startsNFA;
+    LazyDFA *whole;
+    LazyDFA *contains;
+    LazyDFA *starts;
+    bool *startsAt;
+    size_t startsCapacity;
+} GrepMatcher;
+
+// Builds the matcher for a regex, falling back to lazy DFAs when the DFAs
+// are over budget. Returns false if the regex is malformed.
+bool createRegexMatcher(GrepMatcher *matcher, const char *pattern, bool needSearch)
 {
-    bool changed;
-    do
+    NFA *nfa = compileRegex(pattern);
+    if (nfa == NULL)
+        return false;
+
+    DFA *dfa = NFA_to_DFALimited(nfa, DFA_MEMORY_BUDGET);
+    if (dfa != NULL)
     {
-        changed = false;
-        for (int i = 0; i < set->count; i++)
+        matcher->dfa = minimizeDFA(dfa);
+        freeDFA(dfa);
+        finalizeDFA(matcher->dfa);
+        if (needSearch)
+            matcher->search = createSearchDFA(matcher->dfa);
+        if (!needSearch || matcher->search != NULL)
         {
-            int state = set->states[i];
-            for (int j = 0; j < nfa->numEpsilonTransitions[state]; j++)
-            {
-                int epsilonState = nfa->epsilonTransitions[state][j];
-                if (!contains(set, epsilonState))
-                {
-                    set->states[set->count++] = epsilonState;
-                    changed = true;
-                }
-            }
+            freeNFA(nfa);
+            return true;
         }
-    } while (changed);
+        freeDFA(matcher->dfa);
+        matcher->dfa = NULL;
+    }
+
+    // compileRegex gives its NFA one final state
+    int final = nfa->finalStates[0];
+    NFA *contains = compileRegex(pattern);
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        addTransitionNFA(contains, 0, x, 0);
+        addTransitionNFA(contains, final, x, final);
+    }
+    NFA *starts = reverseNFA(nfa);
+    for (int x = 0; x < NUM_BYTES; x++)
+    {
+        addTransitionNFA(starts, 0, x, 0);
+    }
+    matcher->nfa = nfa;
+    matcher->containsNFA = contains;
+    matcher->startsNFA = starts;
+    matcher->whole = createLazyDFA(nfa, GREP_LAZY_STATES);
+    matcher->contains = createLazyDFA(contains, GREP_LAZY_STATES);
+    matcher->starts = createLazyDFA(starts, GREP_LAZY_STATES);
+    return true;
 }
 
-DFA *createDFAForStringsEndingInGH()
+void freeGrepMatcher(GrepMatcher *matcher)
 {
-    printf("Creating DFA for strings ending in 'gh'...\n");
-    int finalStates[] = {2};
-    DFA *dfa = createDFA(3, 1, finalStates);
-
-    // State 0: Initial state
-    // State 1: Seen 'g'
-    // State 2: Seen 'gh' (accepting state)
-
-    // Add transitions
-    for (int c = 0; c < MAX_ALPHABET; c++)
+    if (matcher->search != NULL)
+        freeSearchDFA(matcher->search);
+    if (matcher->dfa != NULL)
+        freeDFA(matcher->dfa);
+    if (matcher->whole != NULL)
     {
-        addTransitionDFA(dfa, 0, c, 0); // Stay in state 0 for all inputs except 'g'
-        addTransitionDFA(dfa, 1, c, 0); // Go back to state 0 for all inputs except 'h'
-        addTransitionDFA(dfa, 2, c, 0); // Go back to state 0 for all inputs
+        freeLazyDFA(matcher->whole);
+        freeLazyDFA(matcher->contains);
+        freeLazyDFA(matcher->starts);
+        freeNFA(matcher->nfa);
+        freeNFA(matcher->containsNFA);
+        freeNFA(matcher->startsNFA);
     }
-
-    addTransitionDFA(dfa, 0, 'g', 1); // Go to state 1 when 'g' is seen
-    addTransitionDFA(dfa, 1, 'h', 2); // Go to state 2 when 'h' is seen after 'g'
-    addTransitionDFA(dfa, 2, 'g', 1); // Allow 'g' to start a new potential match
-
-    printf("DFA created with %d states.\n", dfa->numStates);
-    return dfa;
+    free(matcher->startsAt);
 }
 
-DFA *NFA_to_DFA(NFA *nfa)
+// Finds the leftmost-longest match in line that starts at or after pos, with
+// offsets into line. Without a search DFA, the starts must already have been
+// marked for this line by acceptedBackwardsLazyDFA.
+bool searchGrepMatcher(GrepMatcher *matcher, const char *line, size_t len, size_t pos, Match *match)
 {
-    printf("Starting NFA to DFA conversion...\n");
-    fflush(stdout);
-
-    StateSet *dfaStates = malloc(sizeof(StateSet) * (1 << nfa->numStates));
-    int dfaStateCount = 0;
-
-    StateSet initialSet = {{0}, 1};
-    epsilonClosure(nfa, &initialSet);
-    dfaStates[dfaStateCount++] = initialSet;
+    if (matcher->search != NULL)
+    {
+        if (!searchDFA(matcher->search, line + pos, len - pos, SEARCH_LEFTMOST_LONGEST, match))
+            return false;
+        match->start += pos;
+        match->end += pos;
+        return true;
+    }
 
-    DFA *dfa = createDFA(1, 0, NULL);
+    size_t start = pos, length;
+    while (start <= len && !matcher->startsAt[start])
+        start++;
+    if (start > len || !longestPrefixLazyDFA(matcher->whole, line + start, len - start, &length))
+        return false;
+    match->start = start;
+    match->end = start + length;
+    return true;
+}
 
-    fflush(stdout);
-    // int iterationCount = 0;
-    int processingState = 0;
-    while (processingState < dfaStateCount)
+// Handles one line, without its newline. Returns whether it was selected.
+bool grepLine(GrepMatcher *matcher, const GrepOptions *options, const char *line, size_t len, long number,
+              OutputBuffer *out)
+{
+    DFA *dfa = matcher->dfa;
+    bool matched;
+    if (options->wholeLine && dfa != NULL)
+    {
+        const unsigned char *p = (const unsigned char *)line;
+        matched = !lacksRequiredBytesDFA(dfa, p, p + len) && dfa->accepting[scanDFA(dfa, 0, p, p + len)];
+    }
+    else if (options->wholeLine)
+    {
+        matched = matchLazyDFA(matcher->whole, line, len);
+    }
+    else if (matcher->search != NULL)
     {
-        // iterationCount++;
-        fflush(stdout);
+        matched = searchDFA(matcher->search, line, len, SEARCH_EARLIEST, NULL);
+    }
+    else
+    {
+        matched = matchLazyDFA(matcher->contains, line, len);
+    }
+    if (matched == options->invert)
+        return false;
+    if (options->count)
+        return true;
 
-        StateSet currentSet = dfaStates[processingState];
+    char prefix[32];
+    int prefixLength = options->lineNumber ? snprintf(prefix, sizeof(prefix), "%ld:", number) : 0;
+    if (!options->onlyMatch || options->invert)
+    {
+        writeOutput(out, prefix, prefixLength);
+        writeOutput(out, line, len);
+        writeOutput(out, "\n", 1);
+        return true;
+    }
 
-        for (int c = 0; c < MAX_ALPHABET; c++)
+    // One backward pass finds every offset where a match starts, so each
+    // match below costs only its forward run
+    if (matcher->search == NULL)
+    {
+        if (len + 1 > matcher->startsCapacity)
         {
-            StateSet nextSet = {0};
+            matcher->startsCapacity = len + 1;
+            matcher->startsAt = checkedRealloc(matcher->startsAt, matcher->startsCapacity);
+        }
+        acceptedBackwardsLazyDFA(matcher->starts, line, len, matcher->startsAt);
+    }
 
-            // Compute next state set
-            for (int i = 0; i < currentSet.count; i++)
-            {
-                int state = currentSet.states[i];
-                for (int j = 0; j < nfa->numTransitions[state][c]; j++)
-                {
-                    int nextState = nfa->transitionTable[state][c][j];
-                    if (!contains(&nextSet, nextState))
-                    {
-                        nextSet.states[nextSet.count++] = nextState;
-                    }
-                }
-            }
+    // Non-empty matches, left to right, as grep -o prints them
+    size_t pos = 0;
+    Match match;
+    while (pos < len && searchGrepMatcher(matcher, line, len, pos, &match))
+    {
+        if (match.end > match.start)
+        {
+            writeOutput(out, prefix, prefixLength);
+            writeOutput(out, line + match.start, match.end - match.start);
+            writeOutput(out, "\n", 1);
+        }
+        pos = match.end > match.start ? match.end : match.start + 1;
+    }
+    return true;
+}
 
-            epsilonClosure(nfa, &nextSet);
+// ./automata --grep [-c] [-n] [-o] [-v] [-x] (NAME | -e REGEX) [FILE]
+// Prints the lines of FILE (or stdin) that contain a match of the named
+// built-in or compiled DFA, or of REGEX, like grep. With -x the whole line
+// must be accepted, as in the interactive loop. Input is read and output is
+// written in GREP_BUFFER_SIZE blocks. A REGEX too large to turn into DFAs
+// within DFA_MEMORY_BUDGET is matched by simulating its NFA, which is slower
+// but takes bounded memory. The exit status is 0 if any line was selected, 1
+// if none was and 2 on error.
+int grepMain(int argc, char **argv)
+{
+    GrepOptions options = {false, false, false, false, false};
+    const char *pattern = NULL, *name = NULL, *path = NULL;
+    bool usage = false;
+    int i = 2;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0' && pattern == NULL && !usage; i++)
+    {
+        for (const char *flag = argv[i] + 1; *flag && !usage; flag++)
+        {
+            if (*flag == 'c')
+                options.count = true;
+            else if (*flag == 'v')
+                options.invert = true;
+            else if (*flag == 'x')
+                options.wholeLine = true;
+            else if (*flag == 'n')
+                options.lineNumber = true;
+            else if (*flag == 'o')
+                options.onlyMatch = true;
+            else if (*flag == 'e' && flag[1] == '\0' && i + 1 < argc)
+                pattern = argv[++i];
+            else
+                usage = true;
+        }
+    }
+    if (pattern == NULL && i < argc)
+        name = argv[i++];
+    if (i < argc)
+        path = argv[i++];
+    if (usage || i < argc || (pattern == NULL && name == NULL))
+    {
+        fprintf(stderr, "usage: %s --grep [-c] [-n] [-o] [-v] [-x] (NAME | -e REGEX) [FILE]\n", argv[0]);
+        return 2;
+    }
 
-            if (nextSet.count > 0)
+    GrepMatcher matcher = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0};
+    bool needSearch = !options.wholeLine || options.onlyMatch;
+    if (pattern != NULL)
+    {
+        if (!createRegexMatcher(&matcher, pattern, needSearch))
+            return 2;
+    }
+    else
+    {
+        matcher.dfa = openDFA(name);
+        if (matcher.dfa == NULL)
+            return 2;
+        if (matcher.dfa->scanTable == NULL)
+            finalizeDFA(matcher.dfa);
+        if (needSearch)
+        {
+            matcher.search = createSearchDFA(matcher.dfa);
+            if (matcher.search == NULL)
             {
-                int dfaState = findDFAState(dfaStates, dfaStateCount, &nextSet);
-                if (dfaState == -1)
-                {
-                    dfaState = dfaStateCount;
-                    dfaStates[dfaStateCount++] = nextSet;
-                }
-                addTransitionDFA(dfa, processingState, c, dfaState);
+                fprintf(stderr, "The search DFA for '%s' is too large\n", name);
+                freeGrepMatcher(&matcher);
+                return 2;
             }
         }
-        processingState++;
     }
 
-    // Set final states
-    int finalStates[MAX_STATES];
-    int numFinalStates = 0;
-    for (int i = 0; i < dfaStateCount; i++)
+    int fd = STDIN_FILENO;
+    if (path != NULL && strcmp(path, "-") != 0)
     {
-        StateSet set = dfaStates[i];
-        for (int j = 0; j < set.count; j++)
+        fd = open(path, O_RDONLY);
+        if (fd == -1)
         {
-            if (isNFAFinalState(nfa, set.states[j]))
-            {
-                finalStates[numFinalStates++] = i;
-                break;
-            }
+            perror(path);
+            freeGrepMatcher(&matcher);
+            return 2;
         }
     }
 
-    dfa->numStates = dfaStateCount;
-    dfa->numFinalStates = numFinalStates;
-    memcpy(dfa->finalStates, finalStates, numFinalStates * sizeof(int));
+    // Lines are cut out of the input buffer with memchr. A partial line at
+    // the end of the buffer moves to the front before the next read, and the
+    // buffer doubles when a single line does not fit.
+    size_t capacity = GREP_BUFFER_SIZE, filled = 0;
+    char *buffer = checkedRealloc(NULL, capacity);
+    OutputBuffer out = {checkedRealloc(NULL, GREP_BUFFER_SIZE), 0};
+    long lineNumber = 0, selected = 0;
+    bool failed = false, atEnd = false;
+    while (!atEnd)
+    {
+        if (filled == capacity)
+        {
+            capacity *= 2;
+            buffer = checkedRealloc(buffer, capacity);
+        }
+        ssize_t n = read(fd, buffer + filled, capacity - filled);
+        if (n < 0)
+        {
+            perror(path != NULL ? path : "stdin");
+            failed = true;
+            break;
+        }
+        atEnd = n == 0;
+        filled += n;
+
+        char *line = buffer, *end = buffer + filled;
+        char *newline;
+        while ((newline = memchr(line, '\n', end - line)) != NULL)
+        {
+            selected += grepLine(&matcher, &options, line, newline - line, ++lineNumber, &out);
+            line = newline + 1;
+        }
+        if (atEnd && line < end)
+        {
+            selected += grepLine(&matcher, &options, line, end - line, ++lineNumber, &out);
+            line = end;
+        }
+        filled = end - line;
+        memmove(buffer, line, filled);
+    }
 
-    free(dfaStates);
-    fflush(stdout);
+    if (options.count)
+    {
+        char text[32];
+        writeOutput(&out, text, snprintf(text, sizeof(text), "%ld\n", selected));
+    }
+    flushOutput(&out);
 
-    return dfa;
+    if (fd != STDIN_FILENO)
+        close(fd);
+    free(buffer);
+    free(out.data);
+    freeGrepMatcher(&matcher);
+    return failed ? 2 : selected > 0 ? 0 : 1;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "--stream") == 0)
+        return streamMain(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return benchMain();
+    if (argc > 1 && strcmp(argv[1], "--compile") == 0)
+        return compileMain(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--grep") == 0)
+        return grepMain(argc, argv);
+
     DFA *dfaXYZZY = DFAForContainsXYZZY();
     printf("Testing DFA for strings containing 'xyzzy':\n");
     dfaREPL(dfaXYZZY);
-    free(dfaXYZZY);
+    freeDFA(dfaXYZZY);
 
     DFA *dfa987 = DFASubsequence987();
     printf("Testing DFA for strings containing '987':\n");
     dfaREPL(dfa987);
-    free(dfa987);
+    freeDFA(dfa987);
 
     DFA *dfa4s = DFA4s();
     printf("Testing DFA for strings containing two or three '4':\n");
     dfaREPL(dfa4s);
-    free(dfa4s);
+    freeDFA(dfa4s);
 
     DFA *dfaBinaryParity = DFAForBinaryParity();
     printf("Testing DFA for strings containing odd number of zeroes AND ones:\n");
     dfaREPL(dfaBinaryParity);
-    free(dfaBinaryParity);
+    freeDFA(dfaBinaryParity);
 
     // part 2 NFA
     NFA *nfaGH = NFAStringsEndingInGH();
     printf("Testing NFA for strings ending in 'gh':\n");
     nfaREPL(nfaGH);
-    free(nfaGH);
+    freeNFA(nfaGH);
 
     NFA *nfaMoo = NFAStringsContainingMoo();
     printf("Testing NFA for strings containing 'moo':\n");
     nfaREPL(nfaMoo);
-    free(nfaMoo);
+    freeNFA(nfaMoo);
 
     NFA *nfaSpecialString = NFASpecialString();
     printf("Testing NFA for strings containing >1 'a' or 'i' || >2 'y' || >3 'c' or 'l':\n");
     nfaREPL(nfaSpecialString);
-    free(nfaSpecialString);
+    freeNFA(nfaSpecialString);
 
     // Convert NFA for strings ending in 'gh' to DFA
     NFA *nfaGHConverted = NFAStringsEndingInGH();
+    printf("Starting NFA to DFA conversion...\n");
     DFA *dfaGHConverted = NFA_to_DFA(nfaGHConverted);
-    // printf("DFA for strings ending in 'gh' has %d states.\n", dfaGHConverted->numStates);
+    DFA *dfaGHMinimized = minimizeDFA(dfaGHConverted);
+    printf("DFA for strings ending in 'gh' has %d states, %d after minimization.\n",
+           dfaGHConverted->numStates, dfaGHMinimized->numStates);
     printf("Testing converted DFA for strings ending in 'gh':\n");
-    dfaREPL(dfaGHConverted);
-    free(nfaGHConverted);
-    free(dfaGHConverted);
+    dfaREPL(dfaGHMinimized);
+    freeNFA(nfaGHConverted);
+    freeDFA(dfaGHConverted);
+    freeDFA(dfaGHMinimized);
 
     // Convert NFA for strings containing 'moo' to DFA
     NFA *nfaMooConverted = NFAStringsContainingMoo();
+    printf("Starting NFA to DFA conversion...\n");
     DFA *dfaMooConverted = NFA_to_DFA(nfaMooConverted);
-    // printf("DFA for strings containing 'moo' has %d states.\n", dfaMooConverted->numStates);
+    DFA *dfaMooMinimized = minimizeDFA(dfaMooConverted);
+    printf("DFA for strings containing 'moo' has %d states, %d after minimization.\n",
+           dfaMooConverted->numStates, dfaMooMinimized->numStates);
     printf("Testing converted DFA for strings containing 'moo':\n");
-    dfaREPL(dfaMooConverted);
-    free(nfaMooConverted);
-    free(dfaMooConverted);
+    dfaREPL(dfaMooMinimized);
+    freeNFA(nfaMooConverted);
+    freeDFA(dfaMooConverted);
+    freeDFA(dfaMooMinimized);
 
     printf("Program completed.\n");
 